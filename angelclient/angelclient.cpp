@@ -1,420 +1,754 @@
-#include <QtNetwork>
-#include <QDesktopWidget>
-#include <QMessageBox>
-#include <QPainter>
-#include <QDebug>
-#include "angelclient.h"
-#include "ui_angelclient.h"
-#include "qtsvgbutton.h"
-
-const QString KXmlSource        = "xmlsource";
-const QString KResponseStatus   = "status";
-const QString KResponseText     = "text";
-const QString KResponseType     = "responsetype";
-const QString KRequest          = "request";
-const QString KXqReadResponse   = "let $root := doc($xmlsource)//response return data($root/%1)";
-const int KOneSecondInMs        = 1000;
-
-// commands
-const QByteArray KPlay          = "play";
-const QByteArray KPause         = "pause";
-const QByteArray KNext          = "next";
-const QByteArray KPrev          = "prev";
-const QByteArray KNowPlaying    = "nowplaying";
-const QByteArray KTrackDuration = "trackduration";
-const QByteArray KTrackPosition = "trackposition";
-const QByteArray KConnect       = "connect";
-const QByteArray KSyncNow       = "syncnow";
-
-#ifdef Q_OS_SYMBIAN
-#include <es_sock.h>
-#include <sys/socket.h>
-#include <net/if.h>
-
-static void setDefaultIapL()
-    {
-    RSocketServ serv;
-    CleanupClosePushL(serv);
-    User::LeaveIfError(serv.Connect());
-
-    RConnection conn;
-    CleanupClosePushL(conn);
-    User::LeaveIfError(conn.Open(serv));
-    User::LeaveIfError(conn.Start());
-
-    _LIT(KIapNameSetting, "IAP\\Name");
-    TBuf8<50> iap8Name;
-
-    User::LeaveIfError(conn.GetDesSetting(TPtrC(KIapNameSetting), iap8Name));
-    iap8Name.ZeroTerminate();
-
-    conn.Stop();
-    CleanupStack::PopAndDestroy(&conn);
-    CleanupStack::PopAndDestroy(&serv);
-
-    struct ifreq ifReq;
-    memset(&ifReq, 0, sizeof(struct ifreq));
-    strcpy( ifReq.ifr_name, (char*)iap8Name.Ptr());
-    User::LeaveIfError(setdefaultif( &ifReq ));
-}
-
-static int setDefaultIap()
-{
-    TRAPD(err, setDefaultIapL());
-    qDebug()<<"Error in setDefaultIap: "<<err;
-    return err;
-}
-#endif
-
-
-AngelClient::AngelClient(QWidget *parent) :
-    QWidget(parent),
-    ui(new Ui::AngelClient)
-{
-    mCurrentRequest.clear();
-    ui->setupUi(this);
-    setFixedSize(sizeHint());
-    setLayout(ui->masterLayout);
-    ui->musicControlLayout->setSizeConstraint(QLayout::SetFixedSize);
-    setButtonSize();
-    ui->slider->setTracking(false);
-    mXmlQuery = new QXmlQuery;
-    mBuffer = new QBuffer(this);
-
-    connect(ui->bindButton,SIGNAL(clicked()),this,SLOT(connectToServer()));
-    mClientSocket = new QTcpSocket(this);
-    connect(mClientSocket,SIGNAL(connected()),this,SLOT(handleHostFound()));
-    connect(mClientSocket,SIGNAL(readyRead()),this,SLOT(readServerResponse()));
-    connect(mClientSocket,SIGNAL(error(QAbstractSocket::SocketError)),this,SLOT(handleError(QAbstractSocket::SocketError)));
-
-    // connect player controls
-    connect(ui->playPauseButton,SIGNAL(clicked()),this,SLOT(playPause()));
-    connect(ui->nextButton,SIGNAL(clicked()),this,SLOT(next()));
-    connect(ui->prevButton,SIGNAL(clicked()),this,SLOT(prev()));
-    connect(ui->helpButton,SIGNAL(clicked()),this,SLOT(showHelp()));
-    connect(ui->slider,SIGNAL(valueChanged(int)),this,SLOT(sliderValueChanged(int)));
-    connect(ui->slider,SIGNAL(sliderMoved(int)),this,SLOT(sliderMoved(int)));
-
-#ifdef Q_OS_SYBIAN
-    setDefaultIap();
-#endif
-
-    ui->hostAddress->setText(hostAddressToConnect());
-    ui->port->setText("1500");
-    connectToServer();
-}
-
-AngelClient::~AngelClient()
-{
-    delete ui;
-    delete mXmlQuery;
-}
-
-QSize AngelClient::sizeHint()
-{
-    QSize widgetSize(250,400);
-#ifdef Q_OS_SYMBIAN
-    QDesktopWidget dw;
-    widgetSize = dw.screenGeometry().size();
-#endif
-    qDebug()<<"setting fixed size of "<<widgetSize;
-    return widgetSize;
-}
-
-QString AngelClient::hostAddressToConnect()
-{
-    QString ipAddress;
-    QList<QHostAddress> ipAddressesList = QNetworkInterface::allAddresses();
-    qDebug()<<"ip list"<<ipAddressesList;
-    // use the first non-localhost IPv4 address
-    for (int i = 0; i < ipAddressesList.size(); ++i)
-    {
-        qDebug()<<"ipaddress:"<<ipAddressesList.at(i);
-        if (ipAddressesList.at(i) != QHostAddress::LocalHost &&
-            ipAddressesList.at(i).toIPv4Address())
-        {
-            ipAddress = ipAddressesList.at(i).toString();
-            qDebug()<<"host address to connect "<<ipAddress;
-            return ipAddress;
-        }
-    }
-return QString();
-}
-
-void AngelClient::handleError(QAbstractSocket::SocketError error)
-{
-    qDebug()<<__FUNCTION__;
-    qDebug()<<"errornum:"<<error;
-    ui->connectionStatus->setText(QString().setNum(error) + " " + mClientSocket->errorString());
-}
-
-void AngelClient::connectToServer()
-{
-    qDebug()<<__FUNCTION__;
-    mCurrentRequest = KConnect;
-    QHostAddress hostAddress(ui->hostAddress->text());
-    int port = ui->port->text().toInt();
-    mClientSocket->abort();
-    mClientSocket->connectToHost(hostAddress,port);
-}
-
-void AngelClient::handleHostFound()
-{
-    qDebug()<<__FUNCTION__;
-    ui->console->setText("connected to host");
-}
-
-void AngelClient::readServerResponse()
-{
-    qDebug()<<__FUNCTION__;
-    ui->console->clear();
-    QDataStream in(mClientSocket);
-    in.setVersion(QDataStream::Qt_4_0);
-    in.device()->seek(0);
-    QByteArray response = in.device()->readAll();
-    int stat = readResponse(response,KResponseStatus).toInt();
-    QString request = readResponse(response,KRequest).simplified();
-    QString responseText = readResponse(response,KResponseText).simplified();
-
-    if(200 != stat)
-    {
-        responseText = "Request failed!";
-    }
-
-    // This is a spl case, here we connect to server.
-    else if(KConnect == mCurrentRequest)
-    {
-        ui->connectionStatus->setText(responseText);
-        // Start playing after connection
-        ui->playPauseButton->setText(KPlay);
-        playPause();
-    }
-
-    else if(KSyncNow == responseText)
-    {
-        sync();
-    }
-
-
-
-    // TODO: Use a statemachine to handle it more elegantly
-    else
-    {
-        if(KPlay == request ||
-           KNext == request ||
-           KPrev == request)
-        {
-            if(KPlay == request)
-            {
-                ui->playPauseButton->setEnabled(true);
-                ui->playPauseButton->setText(KPause);
-            }
-            sendRequest(KNowPlaying);
-            ui->playingStatus->setText("Playing");
-        }
-
-        else if(KPause == request)
-        {
-            ui->playPauseButton->setEnabled(true);
-            ui->playPauseButton->setText(KPlay);
-            ui->playingStatus->setText("Paused");
-        }
-
-        else if(KNowPlaying == request)
-        {
-            ui->title->setText(responseText);
-            trackDuration();
-        }
-
-        else if(KTrackDuration == request)
-        {
-            mTrackDurationInSec = timeInSecs(responseText);
-            ui->duration->setText(responseText);
-            trackPosition();
-        }
-
-        else if(KTrackPosition == request)
-        {
-            int secs = timeInSecs(responseText);
-            ui->slider->setRange(0,mTrackDurationInSec);
-            ui->slider->setValue(secs);
-            mTrackTimer.stop();
-            mTrackTimer.start(KOneSecondInMs,this);
-            mTrackElapsedTime.setHMS(0,0,secs,0);
-        }
-    }
-}
-
-QString AngelClient::readResponse(QString aSourceXml,QString aResponseType)
-{
-    mBuffer->setData(aSourceXml.toUtf8());
-    mBuffer->open(QIODevice::ReadOnly);
-    mXmlQuery->bindVariable(KXmlSource,mBuffer);
-    QString query = KXqReadResponse.arg(aResponseType);
-    mXmlQuery->setQuery(query);
-    QString result = QString();
-    if(mXmlQuery->isValid())
-    {
-       mXmlQuery->evaluateTo(&result);
-    }
-    mBuffer->close();
-    return result;
-}
-
-void AngelClient::playPause()
-{
-    if(ui->playPauseButton->text() == KPlay)
-    {
-        sendRequest(KPlay);
-        ui->playPauseButton->setEnabled(false);
-        mIsPaused = false;
-    }
-
-    else if(ui->playPauseButton->text() == KPause)
-    {
-        sendRequest(KPause);
-        ui->playPauseButton->setEnabled(false);
-        mIsPaused = true;
-        mTrackTimer.stop();
-    }
-}
-
-void AngelClient::next()
-{
-    sendRequest(KNext);
-}
-
-void AngelClient::prev()
-{
-    sendRequest(KPrev);
-}
-
-void AngelClient::trackDuration()
-{
-    sendRequest(KTrackDuration);
-}
-
-void AngelClient::trackPosition()
-{
-    sendRequest(KTrackPosition);
-}
-
-void AngelClient::showHelp()
-{
-    QMessageBox msg;
-    msg.setText("Run Angel Server on your computer.\nIn case of connection error, manually set your IP address and port and then click connect.");
-    msg.exec();
-}
-
-int AngelClient::timeInSecs(QString aTimeInText)
-{
-    qDebug()<<aTimeInText;
-    QString timeInText = aTimeInText.simplified();
-    QStringList timeList = timeInText.split(":");
-    qDebug()<<timeList<<timeList.count();
-    mHasHourPart = false;
-    if(2 >= timeList.count() && aTimeInText.contains(":")) // 2: time would be in the format hh:mm:ss
-    {
-        int hr = 0;
-        int index = 0;
-        mHasHourPart = false;
-        if(3 == timeList.count()) // has hour part also
-        {
-            mHasHourPart = true;
-            hr = timeList.at(index).toInt();
-            ++index;
-        }
-
-    int min = timeList.at(index).toInt();
-    index++;
-    int sec = timeList.at(index).toInt();
-    int result = (hr*60)*60 + min*60 + sec;
-    return result;
-    }
-return -1;
-}
-
-void AngelClient::paintEvent(QPaintEvent *aPaintEvent)
-{
-    Q_UNUSED(aPaintEvent);
-    QPixmap bg(":/resources/images/brushedmetal.jpg");
-    QPainter painter(this);
-    painter.setRenderHint(QPainter::SmoothPixmapTransform);
-    painter.drawPixmap(rect(),bg);
-}
-
-void AngelClient::resizeEvent(QResizeEvent *aEvent)
-{
-    setButtonSize();
-}
-
-void AngelClient::setButtonSize()
-{
-    const QString KSkin("Beryl");
-#ifdef Q_OS_SYBIAN
-    QSize buttonSize(150,150);
-#else
-    QSize buttonSize(90,90);
-#endif
-    ui->playPauseButton->resize(buttonSize);
-    ui->playPauseButton->setSkin(KSkin);
-    ui->nextButton->resize(buttonSize);
-    ui->nextButton->setSkin(KSkin);
-    ui->prevButton->resize(buttonSize);
-    ui->prevButton->setSkin(KSkin);
-    ui->playPauseButton->setText(KPause);
-}
-
-void AngelClient::timerEvent(QTimerEvent *aEvent)
-{
-    if(!mIsPaused)
-    {
-        ui->slider->setValue(ui->slider->value()+1);
-    }
-}
-
-void AngelClient::sliderValueChanged(int aNewValue)
-{
-    if(!mIsPaused && aNewValue <= mTrackDurationInSec)
-    {
-        updateElapsedTime();
-    }
-}
-
-void AngelClient::updateElapsedTime()
-{
-    if(!mIsPaused)
-    {
-        mTrackElapsedTime = mTrackElapsedTime.addSecs(1);
-        QString elapsedTimeText; // format time in hh:mm:ss
-        elapsedTimeText = mTrackElapsedTime.toString("mm") + ":" +
-                          mTrackElapsedTime.toString("ss");
-
-        if(mHasHourPart)
-        {
-            elapsedTimeText.insert(0,mTrackElapsedTime.toString("hh")+":");
-        }
-        ui->elapsed->setText(elapsedTimeText);
-    }
-}
-
-void AngelClient::sliderMoved(int aNewValue)
-{
-    Q_UNUSED(aNewValue);
-    // For simplicity, disabling slider movement
-    sync();
-}
-
-void AngelClient::sync()
-{
-    mTrackTimer.stop();
-    sendRequest(KNowPlaying);
-    ui->console->setText("syncing...");
-}
-
-void AngelClient::sendRequest(QByteArray aRequest)
-{
-    mCurrentRequest = aRequest;
-    mClientSocket->write(aRequest);
-}
-// eof
+#include <QtNetwork>
+#include <QDesktopWidget>
+#include <QMessageBox>
+#include <QPainter>
+#include <QDesktopServices>
+#include <QCryptographicHash>
+#include <QDebug>
+#include "angelclient.h"
+#include "ui_angelclient.h"
+#include "qtsvgbutton.h"
+
+const QString KXmlSource        = "xmlsource";
+const QString KResponseStatus   = "status";
+const QString KResponseText     = "text";
+const QString KResponseType     = "responsetype";
+const QString KRequest          = "request";
+const QString KXqReadResponse   = "let $root := doc($xmlsource)//response return data($root/%1)";
+const int KOneSecondInMs        = 1000;
+const QByteArray KResponseEnd   = "</response>";
+const QString KArtworkFolder    = "artwork";
+const int KMaxCachedArtwork     = 200;
+const qint64 KMaxArtworkCacheInBytes = 8*1024*1024;
+const QString KBackgroundImage  = ":/resources/images/brushedmetal.jpg";
+const QString KSkin             = "Beryl";
+const QString KDefaultPort      = "1500";
+const QString KLastKnown        = " (last known)";
+
+// snapshot of the last session
+const QString KHostKey          = "server/host";
+const QString KPortKey          = "server/port";
+const QString KTitleKey         = "track/title";
+const QString KDurationKey      = "track/duration";
+const QString KPositionKey      = "track/position";
+const QString KPlayingKey       = "track/playing";
+const QString KTimestampKey     = "track/timestamp";
+const int KArtworkSizeInPx      = 120;
+const int KStatusGone           = 410;
+const int KMaxArtworkRetries    = 2;
+
+// commands
+const QByteArray KPlay          = "play";
+const QByteArray KPause         = "pause";
+const QByteArray KNext          = "next";
+const QByteArray KPrev          = "prev";
+const QByteArray KNowPlaying    = "nowplaying";
+const QByteArray KTrackDuration = "trackduration";
+const QByteArray KTrackPosition = "trackposition";
+const QByteArray KConnect       = "connect";
+const QByteArray KSyncNow       = "syncnow";
+const QByteArray KArtwork       = "artwork";
+const QByteArray KArtworkChunk  = "artchunk";
+
+#ifdef Q_OS_SYMBIAN
+#include <es_sock.h>
+#include <sys/socket.h>
+#include <net/if.h>
+
+static void setDefaultIapL()
+    {
+    RSocketServ serv;
+    CleanupClosePushL(serv);
+    User::LeaveIfError(serv.Connect());
+
+    RConnection conn;
+    CleanupClosePushL(conn);
+    User::LeaveIfError(conn.Open(serv));
+    User::LeaveIfError(conn.Start());
+
+    _LIT(KIapNameSetting, "IAP\\Name");
+    TBuf8<50> iap8Name;
+
+    User::LeaveIfError(conn.GetDesSetting(TPtrC(KIapNameSetting), iap8Name));
+    iap8Name.ZeroTerminate();
+
+    conn.Stop();
+    CleanupStack::PopAndDestroy(&conn);
+    CleanupStack::PopAndDestroy(&serv);
+
+    struct ifreq ifReq;
+    memset(&ifReq, 0, sizeof(struct ifreq));
+    strcpy( ifReq.ifr_name, (char*)iap8Name.Ptr());
+    User::LeaveIfError(setdefaultif( &ifReq ));
+}
+
+static int setDefaultIap()
+{
+    TRAPD(err, setDefaultIapL());
+    qDebug()<<"Error in setDefaultIap: "<<err;
+    return err;
+}
+#endif
+
+
+AngelClient::AngelClient(QWidget *parent) :
+    QWidget(parent),
+    mArtworkBytes(0),
+    mArtworkRetries(0),
+    mFirstFrameShown(false),
+    mStale(false),
+    mFresh(false),
+    mPositionKnown(false),
+    ui(new Ui::AngelClient)
+{
+    mStartupTime.start();
+    mCurrentRequest.clear();
+    ui->setupUi(this);
+    // paintEvent() covers every pixel, no need to erase first
+    setAttribute(Qt::WA_OpaquePaintEvent);
+    setFixedSize(sizeHint());
+    setLayout(ui->masterLayout);
+    ui->musicControlLayout->setSizeConstraint(QLayout::SetFixedSize);
+    setButtonSize();
+    ui->slider->setTracking(false);
+    mXmlQuery = new QXmlQuery;
+    mBuffer = new QBuffer(this);
+
+    connect(ui->bindButton,SIGNAL(clicked()),this,SLOT(connectToServer()));
+    mClientSocket = new QTcpSocket(this);
+    connect(mClientSocket,SIGNAL(connected()),this,SLOT(handleHostFound()));
+    connect(mClientSocket,SIGNAL(readyRead()),this,SLOT(readServerResponse()));
+    connect(mClientSocket,SIGNAL(error(QAbstractSocket::SocketError)),this,SLOT(handleError(QAbstractSocket::SocketError)));
+
+    // connect player controls
+    connect(ui->playPauseButton,SIGNAL(clicked()),this,SLOT(playPause()));
+    connect(ui->nextButton,SIGNAL(clicked()),this,SLOT(next()));
+    connect(ui->prevButton,SIGNAL(clicked()),this,SLOT(prev()));
+    connect(ui->helpButton,SIGNAL(clicked()),this,SLOT(showHelp()));
+    connect(ui->slider,SIGNAL(valueChanged(int)),this,SLOT(sliderValueChanged(int)));
+    connect(ui->slider,SIGNAL(sliderMoved(int)),this,SLOT(sliderMoved(int)));
+
+#ifdef Q_OS_SYBIAN
+    setDefaultIap();
+#endif
+
+    // Show the last known state right away, the network is brought up
+    // after the first frame and the state is reconciled as responses come in
+    mTrackDurationInSec = 0;
+    mHasHourPart = false;
+    mIsPaused = true;
+    ui->port->setText(KDefaultPort);
+    restoreSnapshot();
+}
+
+AngelClient::~AngelClient()
+{
+    if(!mStale)
+    {
+        saveSnapshot();
+    }
+    delete ui;
+    delete mXmlQuery;
+}
+
+QSize AngelClient::sizeHint()
+{
+    QSize widgetSize(250,400);
+#ifdef Q_OS_SYMBIAN
+    QDesktopWidget dw;
+    widgetSize = dw.screenGeometry().size();
+#endif
+    qDebug()<<"setting fixed size of "<<widgetSize;
+    return widgetSize;
+}
+
+void AngelClient::startConnection()
+{
+    // Enumerating interfaces is slow on some devices, only do it without a saved server
+    if(ui->hostAddress->text().isEmpty())
+    {
+        ui->hostAddress->setText(hostAddressToConnect());
+    }
+    connectToServer();
+}
+
+void AngelClient::restoreSnapshot()
+{
+    QSettings settings;
+    if(!settings.contains(KHostKey))
+    {
+        return;
+    }
+    ui->hostAddress->setText(settings.value(KHostKey).toString());
+    ui->port->setText(settings.value(KPortKey,KDefaultPort).toString());
+    if(!settings.contains(KTitleKey))
+    {
+        return;
+    }
+
+    mStale = true;
+    bool playing = settings.value(KPlayingKey).toBool();
+    QString duration = settings.value(KDurationKey).toString();
+    mTrackDurationInSec = qMax(0,timeInSecs(duration));
+    int position = settings.value(KPositionKey).toInt();
+    if(playing && settings.contains(KPositionKey))
+    {
+        // carry on from where the track would be by now
+        QDateTime saved = settings.value(KTimestampKey).toDateTime();
+        position += qMax(0,saved.secsTo(QDateTime::currentDateTime()));
+        position = qMin(position,mTrackDurationInSec);
+    }
+
+    ui->title->setText(settings.value(KTitleKey).toString());
+    ui->duration->setText(duration);
+    ui->slider->setRange(0,mTrackDurationInSec);
+    ui->slider->blockSignals(true);
+    ui->slider->setValue(position);
+    ui->slider->blockSignals(false);
+    mTrackElapsedTime = QTime(0,0).addSecs(position);
+    showElapsedTime();
+    ui->playingStatus->setText(QString((playing)?("Playing"):("Paused"))+KLastKnown);
+}
+
+void AngelClient::saveSnapshot()
+{
+    QSettings settings;
+    settings.setValue(KHostKey,ui->hostAddress->text());
+    settings.setValue(KPortKey,ui->port->text());
+    if(0 >= mTrackDurationInSec)
+    {
+        // nothing has been played yet, keep the endpoint only
+        settings.remove(KTitleKey);
+        return;
+    }
+    settings.setValue(KTitleKey,ui->title->text());
+    settings.setValue(KDurationKey,ui->duration->text());
+    // a player without trackposition never had a position to save
+    if(mPositionKnown)
+    {
+        settings.setValue(KPositionKey,ui->slider->value());
+    }
+    else
+    {
+        settings.remove(KPositionKey);
+    }
+    settings.setValue(KPlayingKey,!mIsPaused);
+    settings.setValue(KTimestampKey,QDateTime::currentDateTime());
+}
+
+void AngelClient::markFresh()
+{
+    // measured on every launch, whether or not a snapshot was shown first
+    if(mFresh)
+    {
+        return;
+    }
+    mFresh = true;
+    mStale = false;
+    qDebug()<<"time to fresh state:"<<mStartupTime.elapsed()<<"ms";
+    saveSnapshot();
+}
+
+void AngelClient::resetPosition()
+{
+    mPositionKnown = false;
+    mTrackTimer.stop();
+    ui->slider->blockSignals(true);
+    ui->slider->setValue(0);
+    ui->slider->blockSignals(false);
+    mTrackElapsedTime = QTime(0,0);
+    showElapsedTime();
+}
+
+QString AngelClient::hostAddressToConnect()
+{
+    QString ipAddress;
+    QList<QHostAddress> ipAddressesList = QNetworkInterface::allAddresses();
+    qDebug()<<"ip list"<<ipAddressesList;
+    // use the first non-localhost IPv4 address
+    for (int i = 0; i < ipAddressesList.size(); ++i)
+    {
+        qDebug()<<"ipaddress:"<<ipAddressesList.at(i);
+        if (ipAddressesList.at(i) != QHostAddress::LocalHost &&
+            ipAddressesList.at(i).toIPv4Address())
+        {
+            ipAddress = ipAddressesList.at(i).toString();
+            qDebug()<<"host address to connect "<<ipAddress;
+            return ipAddress;
+        }
+    }
+return QString();
+}
+
+void AngelClient::handleError(QAbstractSocket::SocketError error)
+{
+    qDebug()<<__FUNCTION__;
+    qDebug()<<"errornum:"<<error;
+    ui->connectionStatus->setText(QString().setNum(error) + " " + mClientSocket->errorString());
+}
+
+void AngelClient::connectToServer()
+{
+    qDebug()<<__FUNCTION__;
+    mCurrentRequest = KConnect;
+    QHostAddress hostAddress(ui->hostAddress->text());
+    int port = ui->port->text().toInt();
+    mClientSocket->abort();
+    mClientSocket->connectToHost(hostAddress,port);
+}
+
+void AngelClient::handleHostFound()
+{
+    qDebug()<<__FUNCTION__;
+    ui->console->setText("connected to host");
+}
+
+void AngelClient::readServerResponse()
+{
+    qDebug()<<__FUNCTION__;
+    // Artwork chunks interleave with control responses, so a read may hold
+    // several responses or only part of one
+    mResponseBuffer.append(mClientSocket->readAll());
+    int end = mResponseBuffer.indexOf(KResponseEnd);
+    while(-1 != end)
+    {
+        end += KResponseEnd.size();
+        QByteArray response = mResponseBuffer.left(end);
+        mResponseBuffer.remove(0,end);
+        handleResponse(QString::fromUtf8(response));
+        end = mResponseBuffer.indexOf(KResponseEnd);
+    }
+}
+
+void AngelClient::handleResponse(QString aResponse)
+{
+    int stat = readResponse(aResponse,KResponseStatus).toInt();
+    QString request = readResponse(aResponse,KRequest).simplified();
+    QString responseText = readResponse(aResponse,KResponseText).simplified();
+
+    QString operation = request.section(' ',0,0);
+    if(KArtwork == operation || KArtworkChunk == operation)
+    {
+        handleArtworkResponse(stat,request,responseText);
+        return;
+    }
+    ui->console->clear();
+
+    if(200 != stat)
+    {
+        responseText = "Request failed!";
+        // the player may not report a position, the rest is fresh by now
+        if(KTrackPosition == request)
+        {
+            resetPosition();
+            markFresh();
+        }
+    }
+
+    // This is a spl case, here we connect to server.
+    else if(KConnect == mCurrentRequest)
+    {
+        ui->connectionStatus->setText(responseText);
+        // Start playing after connection
+        ui->playPauseButton->setText(KPlay);
+        playPause();
+    }
+
+    else if(KSyncNow == responseText)
+    {
+        sync();
+    }
+
+
+
+    // TODO: Use a statemachine to handle it more elegantly
+    else
+    {
+        if(KPlay == request ||
+           KNext == request ||
+           KPrev == request)
+        {
+            if(KPlay == request)
+            {
+                ui->playPauseButton->setEnabled(true);
+                ui->playPauseButton->setText(KPause);
+            }
+            sendRequest(KNowPlaying);
+            ui->playingStatus->setText("Playing");
+        }
+
+        else if(KPause == request)
+        {
+            ui->playPauseButton->setEnabled(true);
+            ui->playPauseButton->setText(KPlay);
+            ui->playingStatus->setText("Paused");
+            saveSnapshot();
+        }
+
+        else if(KNowPlaying == request)
+        {
+            if(responseText != ui->title->text())
+            {
+                // the snapshot's or the last track's position says nothing about this one
+                resetPosition();
+            }
+            ui->title->setText(responseText);
+            trackDuration();
+            sendRequest(KArtwork+' '+QByteArray::number(KArtworkSizeInPx));
+        }
+
+        else if(KTrackDuration == request)
+        {
+            mTrackDurationInSec = timeInSecs(responseText);
+            ui->duration->setText(responseText);
+            trackPosition();
+        }
+
+        else if(KTrackPosition == request)
+        {
+            int secs = timeInSecs(responseText);
+            ui->slider->setRange(0,mTrackDurationInSec);
+            ui->slider->setValue(secs);
+            mTrackTimer.stop();
+            mTrackTimer.start(KOneSecondInMs,this);
+            mTrackElapsedTime.setHMS(0,0,secs,0);
+            mPositionKnown = (0 <= secs);
+            markFresh();
+            saveSnapshot();
+        }
+    }
+}
+
+QString AngelClient::readResponse(QString aSourceXml,QString aResponseType)
+{
+    mBuffer->setData(aSourceXml.toUtf8());
+    mBuffer->open(QIODevice::ReadOnly);
+    mXmlQuery->bindVariable(KXmlSource,mBuffer);
+    QString query = KXqReadResponse.arg(aResponseType);
+    mXmlQuery->setQuery(query);
+    QString result = QString();
+    if(mXmlQuery->isValid())
+    {
+       mXmlQuery->evaluateTo(&result);
+    }
+    mBuffer->close();
+    return result;
+}
+
+void AngelClient::handleArtworkResponse(int aStatus, QString aRequest, QString aResponseText)
+{
+    if(KArtwork == aRequest.section(' ',0,0))
+    {
+        if(200 != aStatus)
+        {
+            resetArtworkTransfer();
+            ui->artwork->clear();
+            return;
+        }
+        QString hash = aResponseText.section(' ',0,0);
+        if(hash == mArtworkHash)
+        {
+            // shown already, or a transfer that stalled picks up where it was
+            if(mArtworkData.size() < mArtworkBytes)
+            {
+                mArtworkRetries = 0;
+                requestArtworkChunk();
+            }
+            return;
+        }
+        mArtworkHash = hash;
+        mArtworkData.clear();
+        mArtworkBytes = aResponseText.section(' ',1,1).toInt();
+        mArtworkRetries = 0;
+
+        // Covers are cached by content, a cover seen before needs no transfer
+        QPixmap cover;
+        if(cover.load(artworkCacheFile(hash)))
+        {
+            ui->artwork->setPixmap(cover);
+            mArtworkBytes = 0;
+            return;
+        }
+        requestArtworkChunk();
+        return;
+    }
+
+    // artchunk <hash> <offset>, drop chunks of a cover we no longer want
+    if(aRequest.section(' ',1,1) != mArtworkHash)
+    {
+        return;
+    }
+    if(KStatusGone == aStatus)
+    {
+        // evicted on the server, start over
+        resetArtworkTransfer();
+        sendRequest(KArtwork+' '+QByteArray::number(KArtworkSizeInPx));
+        return;
+    }
+    if(200 != aStatus)
+    {
+        // throttled or the server hiccuped, ask again a few times, then give
+        // up so that the next artwork response starts over
+        if(KMaxArtworkRetries > mArtworkRetries)
+        {
+            ++mArtworkRetries;
+            requestArtworkChunk();
+            return;
+        }
+        qDebug()<<"artwork transfer abandoned:"<<aStatus<<aResponseText;
+        resetArtworkTransfer();
+        return;
+    }
+    int offset = aResponseText.section(' ',0,0).toInt();
+    if(offset != mArtworkData.size())
+    {
+        return;
+    }
+    mArtworkRetries = 0;
+    mArtworkData.append(QByteArray::fromBase64(aResponseText.section(' ',1,1).toLatin1()));
+    if(mArtworkData.size() < mArtworkBytes)
+    {
+        requestArtworkChunk();
+        return;
+    }
+
+    QString hash = QCryptographicHash::hash(mArtworkData,QCryptographicHash::Md5).toHex();
+    QPixmap cover;
+    if(hash != mArtworkHash || !cover.loadFromData(mArtworkData))
+    {
+        qDebug()<<"artwork transfer failed";
+        resetArtworkTransfer();
+        return;
+    }
+    ui->artwork->setPixmap(cover);
+    QFile file(artworkCacheFile(hash));
+    if(file.open(QIODevice::WriteOnly))
+    {
+        file.write(mArtworkData);
+        file.close();
+        pruneArtworkCache();
+    }
+    mArtworkData.clear();
+    mArtworkBytes = 0;
+}
+
+void AngelClient::pruneArtworkCache()
+{
+    // Newest first, whatever is past either limit goes
+    QDir dir(QDesktopServices::storageLocation(QDesktopServices::CacheLocation));
+    dir.cd(KArtworkFolder);
+    QFileInfoList covers = dir.entryInfoList(QDir::Files,QDir::Time);
+    qint64 bytes = 0;
+    for(int i = 0; i < covers.count(); ++i)
+    {
+        bytes += covers.at(i).size();
+        if(KMaxCachedArtwork <= i || KMaxArtworkCacheInBytes < bytes)
+        {
+            qDebug()<<__FUNCTION__<<covers.at(i).fileName();
+            dir.remove(covers.at(i).fileName());
+        }
+    }
+}
+
+void AngelClient::resetArtworkTransfer()
+{
+    mArtworkHash.clear();
+    mArtworkData.clear();
+    mArtworkBytes = 0;
+    mArtworkRetries = 0;
+}
+
+void AngelClient::requestArtworkChunk()
+{
+    sendRequest(KArtworkChunk+' '+mArtworkHash.toLatin1()+' '+QByteArray::number(mArtworkData.size()));
+}
+
+QString AngelClient::artworkCacheFile(QString aHash)
+{
+    QDir dir(QDesktopServices::storageLocation(QDesktopServices::CacheLocation));
+    dir.mkpath(KArtworkFolder);
+    return dir.filePath(KArtworkFolder+'/'+aHash+".jpg");
+}
+
+void AngelClient::playPause()
+{
+    if(ui->playPauseButton->text() == KPlay)
+    {
+        sendRequest(KPlay);
+        ui->playPauseButton->setEnabled(false);
+        mIsPaused = false;
+    }
+
+    else if(ui->playPauseButton->text() == KPause)
+    {
+        sendRequest(KPause);
+        ui->playPauseButton->setEnabled(false);
+        mIsPaused = true;
+        mTrackTimer.stop();
+    }
+}
+
+void AngelClient::next()
+{
+    sendRequest(KNext);
+}
+
+void AngelClient::prev()
+{
+    sendRequest(KPrev);
+}
+
+void AngelClient::trackDuration()
+{
+    sendRequest(KTrackDuration);
+}
+
+void AngelClient::trackPosition()
+{
+    sendRequest(KTrackPosition);
+}
+
+void AngelClient::showHelp()
+{
+    QMessageBox msg;
+    msg.setText("Run Angel Server on your computer.\nIn case of connection error, manually set your IP address and port and then click connect.");
+    msg.exec();
+}
+
+int AngelClient::timeInSecs(QString aTimeInText)
+{
+    qDebug()<<aTimeInText;
+    QString timeInText = aTimeInText.simplified();
+    QStringList timeList = timeInText.split(":");
+    qDebug()<<timeList<<timeList.count();
+    mHasHourPart = false;
+    if((2 == timeList.count() || 3 == timeList.count()) && aTimeInText.contains(":")) // mm:ss or hh:mm:ss
+    {
+        int hr = 0;
+        int index = 0;
+        mHasHourPart = false;
+        if(3 == timeList.count()) // has hour part also
+        {
+            mHasHourPart = true;
+            hr = timeList.at(index).toInt();
+            ++index;
+        }
+
+    int min = timeList.at(index).toInt();
+    index++;
+    int sec = timeList.at(index).toInt();
+    int result = (hr*60)*60 + min*60 + sec;
+    return result;
+    }
+return -1;
+}
+
+void AngelClient::paintEvent(QPaintEvent *aPaintEvent)
+{
+    if(!mFirstFrameShown)
+    {
+        mFirstFrameShown = true;
+        qDebug()<<"time to first frame:"<<mStartupTime.elapsed()<<"ms";
+        QTimer::singleShot(0,this,SLOT(startConnection()));
+    }
+
+    // Decode and scale once per size, a repaint only copies the damaged part
+    if(mBackground.size() != size())
+    {
+        mBackground = QPixmap(KBackgroundImage).scaled(size(),Qt::IgnoreAspectRatio,Qt::SmoothTransformation);
+    }
+    QPainter painter(this);
+    painter.drawPixmap(aPaintEvent->rect(),mBackground,aPaintEvent->rect());
+}
+
+void AngelClient::resizeEvent(QResizeEvent *aEvent)
+{
+    setButtonSize();
+}
+
+void AngelClient::setButtonSize()
+{
+#ifdef Q_OS_SYBIAN
+    QSize buttonSize(150,150);
+#else
+    QSize buttonSize(90,90);
+#endif
+    if(buttonSize == mButtonSize)
+    {
+        return;
+    }
+
+    // Parsing the svg skin is costly, load it only the first time. The
+    // rendering of the states stays with QtSvgButton, the size is fixed per
+    // platform so a per size pixmap cache would never be hit.
+    if(!mButtonSize.isValid())
+    {
+        ui->playPauseButton->setSkin(KSkin);
+        ui->nextButton->setSkin(KSkin);
+        ui->prevButton->setSkin(KSkin);
+        ui->playPauseButton->setText(KPause);
+    }
+    mButtonSize = buttonSize;
+    ui->playPauseButton->resize(buttonSize);
+    ui->nextButton->resize(buttonSize);
+    ui->prevButton->resize(buttonSize);
+}
+
+void AngelClient::timerEvent(QTimerEvent *aEvent)
+{
+    if(!mIsPaused)
+    {
+        ui->slider->setValue(ui->slider->value()+1);
+    }
+}
+
+void AngelClient::sliderValueChanged(int aNewValue)
+{
+    if(!mIsPaused && aNewValue <= mTrackDurationInSec)
+    {
+        updateElapsedTime();
+    }
+}
+
+void AngelClient::updateElapsedTime()
+{
+    if(!mIsPaused)
+    {
+        mTrackElapsedTime = mTrackElapsedTime.addSecs(1);
+        showElapsedTime();
+    }
+}
+
+void AngelClient::showElapsedTime()
+{
+    QString elapsedTimeText; // format time in hh:mm:ss
+    elapsedTimeText = mTrackElapsedTime.toString("mm") + ":" +
+                      mTrackElapsedTime.toString("ss");
+
+    if(mHasHourPart)
+    {
+        elapsedTimeText.insert(0,mTrackElapsedTime.toString("hh")+":");
+    }
+    ui->elapsed->setText(elapsedTimeText);
+}
+
+void AngelClient::sliderMoved(int aNewValue)
+{
+    Q_UNUSED(aNewValue);
+    // For simplicity, disabling slider movement
+    sync();
+}
+
+void AngelClient::sync()
+{
+    mTrackTimer.stop();
+    sendRequest(KNowPlaying);
+    ui->console->setText("syncing...");
+}
+
+void AngelClient::sendRequest(QByteArray aRequest)
+{
+    mCurrentRequest = aRequest;
+    mClientSocket->write(aRequest+'\n');
+}
+// eof
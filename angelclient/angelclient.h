@@ -1,68 +1,94 @@
-#ifndef ANGELCLIENT_H
-#define ANGELCLIENT_H
-
-#include <QWidget>
-#include <QAbstractSocket>
-#include <QTime>
-#include <QBasicTimer>
-#include <QXmlQuery>
-#include <QBuffer>
-namespace Ui {
-    class AngelClient;
-}
-
-
-class QTcpSocket;
-class QAbstractSocket;
-class AngelClient : public QWidget
-{
-    Q_OBJECT
-
-public:
-    explicit AngelClient(QWidget *parent = 0);
-    ~AngelClient();
-    QSize sizeHint();
-
-private slots:
-    void handleHostFound();
-    void readServerResponse();
-    void connectToServer();
-    void handleError(QAbstractSocket::SocketError error);
-    void playPause();
-    void next();
-    void prev();
-    void trackDuration();
-    void trackPosition();
-    void showHelp();
-    void sendRequest(QByteArray aRequest);
-    void sliderValueChanged(int aNewValue);
-    void sliderMoved(int aNewValue);
-    void updateElapsedTime();
-    void sync();
-    QString hostAddressToConnect();
-
-private:
-    QString readResponse(QString aSourceXml,QString aResponseType);
-    int timeInSecs(QString aTimeInText);
-    void timerEvent(QTimerEvent *aEvent);
-    void paintEvent(QPaintEvent *aPaintEvent);
-    void resizeEvent(QResizeEvent *aEvent);
-    void setButtonSize();
-
-private:
-    QTcpSocket* mClientSocket;
-    QByteArray mCurrentRequest;
-    int mTrackDurationInSec;
-    QTime mTrackElapsedTime;
-    bool mHasHourPart;
-    bool mIsPaused;
-    int mSyncTimerId;
-    QBasicTimer mTrackTimer;
-    QXmlQuery* mXmlQuery;
-    QBuffer* mBuffer;
-
-private:
-    Ui::AngelClient *ui;
-};
-
-#endif // ANGELCLIENT_H
+#ifndef ANGELCLIENT_H
+#define ANGELCLIENT_H
+
+#include <QWidget>
+#include <QAbstractSocket>
+#include <QTime>
+#include <QBasicTimer>
+#include <QXmlQuery>
+#include <QBuffer>
+#include <QPixmap>
+namespace Ui {
+    class AngelClient;
+}
+
+
+class QTcpSocket;
+class QAbstractSocket;
+class AngelClient : public QWidget
+{
+    Q_OBJECT
+    friend class ProtocolBench;
+
+public:
+    explicit AngelClient(QWidget *parent = 0);
+    ~AngelClient();
+    QSize sizeHint();
+
+private slots:
+    void handleHostFound();
+    void readServerResponse();
+    void handleResponse(QString aResponse);
+    void connectToServer();
+    void handleError(QAbstractSocket::SocketError error);
+    void playPause();
+    void next();
+    void prev();
+    void trackDuration();
+    void trackPosition();
+    void showHelp();
+    void sendRequest(QByteArray aRequest);
+    void sliderValueChanged(int aNewValue);
+    void sliderMoved(int aNewValue);
+    void updateElapsedTime();
+    void sync();
+    QString hostAddressToConnect();
+    void startConnection();
+
+private:
+    QString readResponse(QString aSourceXml,QString aResponseType);
+    void handleArtworkResponse(int aStatus, QString aRequest, QString aResponseText);
+    void requestArtworkChunk();
+    void resetArtworkTransfer();
+    QString artworkCacheFile(QString aHash);
+    void pruneArtworkCache();
+    int timeInSecs(QString aTimeInText);
+    void timerEvent(QTimerEvent *aEvent);
+    void paintEvent(QPaintEvent *aPaintEvent);
+    void resizeEvent(QResizeEvent *aEvent);
+    void setButtonSize();
+    void showElapsedTime();
+    void restoreSnapshot();
+    void saveSnapshot();
+    void markFresh();
+    void resetPosition();
+
+private:
+    QTcpSocket* mClientSocket;
+    QByteArray mCurrentRequest;
+    int mTrackDurationInSec;
+    QTime mTrackElapsedTime;
+    bool mHasHourPart;
+    bool mIsPaused;
+    int mSyncTimerId;
+    QBasicTimer mTrackTimer;
+    QXmlQuery* mXmlQuery;
+    QBuffer* mBuffer;
+    QByteArray mResponseBuffer;
+    QString mArtworkHash;
+    QByteArray mArtworkData;
+    int mArtworkBytes;      // size of the cover being transferred, 0 when none is
+    int mArtworkRetries;
+    QPixmap mBackground;    // background scaled to the widget size
+    QSize mButtonSize;
+    QTime mStartupTime;
+    bool mFirstFrameShown;
+    bool mStale;            // showing the snapshot of the last session
+    bool mFresh;            // state reconciled with the server since launch
+    bool mPositionKnown;    // the slider holds a position the server reported
+
+private:
+    Ui::AngelClient *ui;
+};
+
+#endif // ANGELCLIENT_H
@@ -0,0 +1,154 @@
+#include <QDebug>
+#include "admissioncontrol.h"
+#include "clientsession.h"
+
+// Sustained rate and burst per operation class. A person tapping buttons or the
+// client walking nowplaying -> trackduration -> trackposition stays well below,
+// a stuck repeat key or a polling loop does not.
+struct BucketLimit
+{
+    double ratePerSecond;
+    double burst;
+};
+
+const BucketLimit KLimits[AdmissionControl::OperationClassCount] =
+{
+    { 4.0, 8.0 },       // ControlOperation
+    { 3.0, 6.0 },       // QueryOperation
+    { 5.0, 10.0 },      // ServerOperation
+    { 16.0, 32.0 }      // ArtworkOperation
+};
+
+// The player runs one command at a time, so waiting is kept short: a session
+// may have a couple of commands queued and all sessions together a few more
+const int KMaxQueuedPerSession = 2;
+const int KMaxQueuedCommands = 8;
+const int KLogThrottledEvery = 50;
+
+AdmissionControl::AdmissionControl(QObject *parent)
+:   QObject(parent), mQueued(0)
+{
+    mClock.start();
+}
+
+AdmissionControl::~AdmissionControl()
+{
+}
+
+void AdmissionControl::addSession(ClientSession* aSession)
+{
+    SessionState state;
+    state.peerName = aSession->peerName();
+    qint64 now = mClock.elapsed();
+    for(int i = 0; i < OperationClassCount; ++i)
+    {
+        state.buckets[i].tokens = KLimits[i].burst;
+        state.buckets[i].refilledAt = now;
+    }
+    state.admitted = 0;
+    state.throttled = 0;
+    state.refused = 0;
+    mSessions.insert(aSession,state);
+}
+
+void AdmissionControl::removeSession(ClientSession* aSession)
+{
+    QHash<ClientSession*,SessionState>::iterator state = mSessions.find(aSession);
+    if(mSessions.end() == state)
+    {
+        return;
+    }
+    qDebug()<<__FUNCTION__<<counters(*state);
+    mQueued -= state->queue.count();
+    mRoundRobin.removeAll(aSession);
+    mSessions.erase(state);
+}
+
+bool AdmissionControl::admit(ClientSession* aSession, OperationClass aClass)
+{
+    QHash<ClientSession*,SessionState>::iterator state = mSessions.find(aSession);
+    if(mSessions.end() == state)
+    {
+        return false;
+    }
+
+    TokenBucket& bucket = state->buckets[aClass];
+    const BucketLimit& limit = KLimits[aClass];
+    qint64 now = mClock.elapsed();
+    bucket.tokens = qMin(limit.burst,bucket.tokens+(now-bucket.refilledAt)*limit.ratePerSecond/1000.0);
+    bucket.refilledAt = now;
+    if(1.0 > bucket.tokens)
+    {
+        ++state->throttled;
+        if(1 == state->throttled%KLogThrottledEvery)
+        {
+            qDebug()<<"throttling"<<counters(*state);
+        }
+        return false;
+    }
+    bucket.tokens -= 1.0;
+    ++state->admitted;
+    return true;
+}
+
+bool AdmissionControl::enqueue(ClientSession* aSession, QString aRequest)
+{
+    QHash<ClientSession*,SessionState>::iterator state = mSessions.find(aSession);
+    if(mSessions.end() == state)
+    {
+        return false;
+    }
+    if(KMaxQueuedPerSession <= state->queue.count() || KMaxQueuedCommands <= mQueued)
+    {
+        ++state->refused;
+        return false;
+    }
+    if(state->queue.isEmpty())
+    {
+        mRoundRobin.append(aSession);
+    }
+    state->queue.enqueue(aRequest);
+    ++mQueued;
+    return true;
+}
+
+bool AdmissionControl::takeNext(ClientSession*& aSession, QString& aRequest)
+{
+    if(mRoundRobin.isEmpty())
+    {
+        return false;
+    }
+    // one command per turn, a session with more waiting goes to the back
+    aSession = mRoundRobin.takeFirst();
+    SessionState& state = mSessions[aSession];
+    aRequest = state.queue.dequeue();
+    --mQueued;
+    if(!state.queue.isEmpty())
+    {
+        mRoundRobin.append(aSession);
+    }
+    return true;
+}
+
+int AdmissionControl::queuedCount() const
+{
+    return mQueued;
+}
+
+QStringList AdmissionControl::statistics() const
+{
+    QStringList result;
+    foreach(const SessionState& state, mSessions)
+    {
+        result.append(counters(state));
+    }
+    return result;
+}
+
+QString AdmissionControl::counters(const SessionState& aState)
+{
+    return QString("%1 admitted %2 throttled %3 refused %4")
+           .arg(aState.peerName,QString::number(aState.admitted),QString::number(aState.throttled),QString::number(aState.refused));
+}
+
+//eof
@@ -0,0 +1,68 @@
+#ifndef ADMISSIONCONTROL_H
+#define ADMISSIONCONTROL_H
+
+#include <QObject>
+#include <QHash>
+#include <QList>
+#include <QQueue>
+#include <QStringList>
+#include <QElapsedTimer>
+
+class ClientSession;
+
+// Keeps one controller from starving the others. Every session has a token
+// bucket per class of operation. Player commands wait in short per session
+// queues that are drained round robin, whatever does not fit is refused at once.
+class AdmissionControl : public QObject
+{
+    Q_OBJECT
+
+public:
+    enum OperationClass
+    {
+        ControlOperation,   // changes the player state: play, next, enqueue...
+        QueryOperation,     // asks the player: nowplaying, trackduration...
+        ServerOperation,    // answered by the server itself: library, stats
+        ArtworkOperation,   // artwork and its chunks, these come in bursts
+        OperationClassCount
+    };
+
+    explicit AdmissionControl(QObject *parent = 0);
+    ~AdmissionControl();
+
+    void addSession(ClientSession* aSession);
+    void removeSession(ClientSession* aSession);
+
+    bool admit(ClientSession* aSession, OperationClass aClass);
+    bool enqueue(ClientSession* aSession, QString aRequest);
+    bool takeNext(ClientSession*& aSession, QString& aRequest);
+    int queuedCount() const;
+    QStringList statistics() const;
+
+private:
+    struct TokenBucket
+    {
+        double tokens;
+        qint64 refilledAt;  // ms on mClock
+    };
+
+    struct SessionState
+    {
+        QString peerName;   // kept for the counters, the socket may be gone
+        TokenBucket buckets[OperationClassCount];
+        QQueue<QString> queue;
+        int admitted;
+        int throttled;
+        int refused;
+    };
+
+    static QString counters(const SessionState& aState);
+
+private:
+    QHash<ClientSession*,SessionState> mSessions;
+    QList<ClientSession*> mRoundRobin;  // sessions with queued commands, the first is served next
+    QElapsedTimer mClock;
+    int mQueued;
+};
+
+#endif // ADMISSIONCONTROL_H
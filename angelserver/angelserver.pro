@@ -1,20 +1,38 @@
-HEADERS       = server.h
-SOURCES       = server.cpp \
-                main.cpp
-QT           += network xmlpatterns
-
-# install
-target.path = $$[QT_INSTALL_EXAMPLES]/network/fortuneserver
-sources.files = $$SOURCES $$HEADERS $$RESOURCES $$FORMS fortuneserver.pro
-sources.path = $$[QT_INSTALL_EXAMPLES]/network/fortuneserver
-INSTALLS += target sources
-
-symbian {
-    TARGET.UID3 = 0xA000CF71
-    include($$QT_SOURCE_TREE/examples/symbianpkgrules.pri)
-    TARGET.CAPABILITY = "NetworkServices ReadUserData"
-    TARGET.EPOCHEAPSIZE = 0x20000 0x2000000
-}
-
-RESOURCES += \
-    resources.qrc
+HEADERS       = server.h \
+                playerdetector.h \
+                libraryindex.h \
+                artworkcache.h \
+                clientsession.h \
+                webgateway.h \
+                admissioncontrol.h
+SOURCES       = server.cpp \
+                playerdetector.cpp \
+                libraryindex.cpp \
+                artworkcache.cpp \
+                clientsession.cpp \
+                webgateway.cpp \
+                admissioncontrol.cpp \
+                main.cpp
+QT           += network
+# permessage-deflate for browser controllers, where zlib is part of the system.
+# Without it the web gateway still works, uncompressed.
+unix {
+    DEFINES  += WEBSOCKET_DEFLATE
+    LIBS     += -lz
+}
+
+# install
+target.path = $$[QT_INSTALL_EXAMPLES]/network/fortuneserver
+sources.files = $$SOURCES $$HEADERS $$RESOURCES $$FORMS fortuneserver.pro
+sources.path = $$[QT_INSTALL_EXAMPLES]/network/fortuneserver
+INSTALLS += target sources
+
+symbian {
+    TARGET.UID3 = 0xA000CF71
+    include($$QT_SOURCE_TREE/examples/symbianpkgrules.pri)
+    TARGET.CAPABILITY = "NetworkServices ReadUserData"
+    TARGET.EPOCHEAPSIZE = 0x20000 0x2000000
+}
+
+RESOURCES += \
+    resources.qrc
@@ -0,0 +1,147 @@
+#include <QtCore>
+#include <QtConcurrentRun>
+#include <QImage>
+#include <QImageReader>
+#include <QBuffer>
+#include <QDebug>
+#include "artworkcache.h"
+
+const char* const KThumbnailFormat = "JPG";
+const int KThumbnailQuality = 85;
+const int KMaxCacheCostInBytes = 4*1024*1024;
+
+ArtworkCache::ArtworkCache(QObject *parent)
+:   QObject(parent), mThumbnails(KMaxCacheCostInBytes)
+{
+}
+
+ArtworkCache::~ArtworkCache()
+{
+    foreach(QFutureWatcher<ArtworkThumbnail>* watcher, mLoading)
+    {
+        watcher->waitForFinished();
+    }
+}
+
+QString ArtworkCache::key(QString aTrack, int aSize)
+{
+    return aTrack+'@'+QString::number(aSize);
+}
+
+QString ArtworkCache::coverInFolder(QString aFolder)
+{
+    // Usual names first, otherwise any image in the album folder
+    QStringList filters;
+    filters<<"*.jpg"<<"*.jpeg"<<"*.png";
+    QStringList images = QDir(aFolder).entryList(filters,QDir::Files|QDir::Readable,QDir::Name|QDir::IgnoreCase);
+    if(images.isEmpty())
+    {
+        return QString();
+    }
+    QStringList preferred;
+    preferred<<"cover"<<"folder"<<"front"<<"album";
+    foreach(QString name, preferred)
+    {
+        foreach(QString image, images)
+        {
+            if(image.startsWith(name,Qt::CaseInsensitive))
+            {
+                return QDir(aFolder).filePath(image);
+            }
+        }
+    }
+    return QDir(aFolder).filePath(images.first());
+}
+
+const ArtworkThumbnail* ArtworkCache::find(QString aKey) const
+{
+    return mThumbnails.object(aKey);
+}
+
+const ArtworkThumbnail* ArtworkCache::findByHash(QByteArray aHash) const
+{
+    // The map is not trimmed on eviction, so look the key up in the cache again
+    QHash<QByteArray,QString>::const_iterator found = mKeysByHash.find(aHash);
+    if(mKeysByHash.end() == found)
+    {
+        return 0;
+    }
+    const ArtworkThumbnail* thumbnail = mThumbnails.object(found.value());
+    return (thumbnail && thumbnail->hash == aHash)?(thumbnail):(0);
+}
+
+void ArtworkCache::load(QString aKey, QString aImagePath, int aSize)
+{
+    if(mLoading.contains(aKey))
+    {
+        return;
+    }
+    QFutureWatcher<ArtworkThumbnail>* watcher = new QFutureWatcher<ArtworkThumbnail>(this);
+    connect(watcher,SIGNAL(finished()),this,SLOT(scaleFinished()));
+    mLoading.insert(aKey,watcher);
+    watcher->setFuture(QtConcurrent::run(&ArtworkCache::scale,aKey,aImagePath,aSize));
+}
+
+void ArtworkCache::scaleFinished()
+{
+    QFutureWatcher<ArtworkThumbnail>* watcher = static_cast<QFutureWatcher<ArtworkThumbnail>*>(sender());
+    ArtworkThumbnail result = watcher->result();
+    mLoading.remove(result.key);
+    watcher->deleteLater();
+
+    if(result.data.isEmpty())
+    {
+        emit loaded(result.key,false);
+        return;
+    }
+    ArtworkThumbnail* thumbnail = new ArtworkThumbnail(result);
+    mKeysByHash.insert(thumbnail->hash,thumbnail->key);
+    mThumbnails.insert(thumbnail->key,thumbnail,thumbnail->data.size());
+    // drop hashes of evicted thumbnails now and then
+    if(mKeysByHash.count() > 2*mThumbnails.count()+16)
+    {
+        QMutableHashIterator<QByteArray,QString> it(mKeysByHash);
+        while(it.hasNext())
+        {
+            it.next();
+            if(!mThumbnails.contains(it.value()))
+            {
+                it.remove();
+            }
+        }
+    }
+    emit loaded(result.key,true);
+}
+
+ArtworkThumbnail ArtworkCache::scale(QString aKey, QString aImagePath, int aSize)
+{
+    ArtworkThumbnail thumbnail;
+    thumbnail.key = aKey;
+
+    // Let the reader scale while decoding, big covers are never fully decoded
+    QImageReader reader(aImagePath);
+    QSize size = reader.size();
+    if(size.isValid())
+    {
+        size.scale(aSize,aSize,Qt::KeepAspectRatio);
+        reader.setScaledSize(size);
+    }
+    QImage image = reader.read();
+    if(image.isNull())
+    {
+        qDebug()<<"cannot read artwork"<<aImagePath<<reader.errorString();
+        return thumbnail;
+    }
+    if(image.width() > aSize || image.height() > aSize)
+    {
+        image = image.scaled(aSize,aSize,Qt::KeepAspectRatio,Qt::SmoothTransformation);
+    }
+
+    QBuffer buffer(&thumbnail.data);
+    buffer.open(QIODevice::WriteOnly);
+    image.save(&buffer,KThumbnailFormat,KThumbnailQuality);
+    thumbnail.hash = QCryptographicHash::hash(thumbnail.data,QCryptographicHash::Md5).toHex();
+    return thumbnail;
+}
+
+//eof
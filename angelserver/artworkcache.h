@@ -0,0 +1,49 @@
+#ifndef ARTWORKCACHE_H
+#define ARTWORKCACHE_H
+
+#include <QObject>
+#include <QCache>
+#include <QHash>
+#include <QFutureWatcher>
+
+// A cover scaled to the size a client asked for, encoded and ready to send
+struct ArtworkThumbnail
+{
+    QString key;
+    QByteArray data;
+    QByteArray hash;    // md5 of data, clients cache covers by it
+};
+
+// Bounded LRU of scaled covers keyed by track and size. Covers are decoded and
+// scaled on a worker thread so the server keeps answering control requests.
+class ArtworkCache : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit ArtworkCache(QObject *parent = 0);
+    ~ArtworkCache();
+
+    static QString key(QString aTrack, int aSize);
+    static QString coverInFolder(QString aFolder);
+
+    const ArtworkThumbnail* find(QString aKey) const;
+    const ArtworkThumbnail* findByHash(QByteArray aHash) const;
+    void load(QString aKey, QString aImagePath, int aSize);
+
+signals:
+    void loaded(QString aKey, bool aSucceeded);
+
+private slots:
+    void scaleFinished();
+
+private:
+    static ArtworkThumbnail scale(QString aKey, QString aImagePath, int aSize);
+
+private:
+    QCache<QString,ArtworkThumbnail> mThumbnails;
+    QHash<QByteArray,QString> mKeysByHash;
+    QHash<QString,QFutureWatcher<ArtworkThumbnail>*> mLoading;
+};
+
+#endif // ARTWORKCACHE_H
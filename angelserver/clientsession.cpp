@@ -0,0 +1,100 @@
+#include <QtNetwork>
+#include <QDebug>
+#include "clientsession.h"
+
+const int KLegacyRequestIdleInMs = 300;
+const int KMaxRequestInBytes = 8192;
+
+ClientSession::ClientSession(QObject *parent)
+:   QObject(parent)
+{
+}
+
+ClientSession::~ClientSession()
+{
+}
+
+TcpSession::TcpSession(QTcpSocket* aSocket, QObject *parent)
+:   ClientSession(parent), mSocket(aSocket)
+{
+    mSocket->setParent(this);
+    connect(mSocket,SIGNAL(readyRead()),this,SLOT(readRequests()));
+    connect(mSocket,SIGNAL(disconnected()),this,SLOT(handleDisconnected()));
+}
+
+TcpSession::~TcpSession()
+{
+}
+
+void TcpSession::send(const QString& aFrame)
+{
+    mSocket->write(aFrame.toUtf8());
+}
+
+QString TcpSession::peerName() const
+{
+    return mSocket->peerAddress().toString()+':'+QString::number(mSocket->peerPort());
+}
+
+void TcpSession::readRequests()
+{
+    // Requests end with a newline and may arrive split over several reads
+    mPending.append(mSocket->readAll());
+    int end = mPending.lastIndexOf('\n');
+    if(-1 != end)
+    {
+        QList<QByteArray> requests = mPending.left(end).split('\n');
+        mPending.remove(0,end+1);
+        foreach(const QByteArray& data, requests)
+        {
+            emitRequest(data);
+        }
+    }
+
+    if(KMaxRequestInBytes < mPending.size())
+    {
+        qDebug()<<"request too long, dropping"<<peerName();
+        mPending.clear();
+        mSocket->abort();
+        return;
+    }
+    // Older clients send a single bare request, it is complete once the line goes quiet
+    if(mPending.isEmpty())
+    {
+        mIdleTimer.stop();
+    }
+    else
+    {
+        mIdleTimer.start(KLegacyRequestIdleInMs,this);
+    }
+}
+
+void TcpSession::timerEvent(QTimerEvent *aEvent)
+{
+    if(aEvent->timerId() != mIdleTimer.timerId())
+    {
+        ClientSession::timerEvent(aEvent);
+        return;
+    }
+    mIdleTimer.stop();
+    QByteArray data = mPending;
+    mPending.clear();
+    emitRequest(data);
+}
+
+void TcpSession::emitRequest(const QByteArray& aData)
+{
+    QString request = QString::fromUtf8(aData).simplified();
+    if(!request.isEmpty())
+    {
+        emit requestReceived(request);
+    }
+}
+
+void TcpSession::handleDisconnected()
+{
+    emit closed();
+    deleteLater();
+}
+
+//eof
@@ -0,0 +1,55 @@
+#ifndef CLIENTSESSION_H
+#define CLIENTSESSION_H
+
+#include <QObject>
+#include <QString>
+#include <QByteArray>
+#include <QBasicTimer>
+
+class QTcpSocket;
+
+// A connected controller. The server only sees requests and response frames,
+// how they travel (raw tcp, websocket) is up to the session.
+class ClientSession : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit ClientSession(QObject *parent = 0);
+    virtual ~ClientSession();
+
+    virtual void send(const QString& aFrame) = 0;
+    virtual QString peerName() const = 0;
+
+signals:
+    void requestReceived(QString aRequest);
+    void closed();
+};
+
+// Native client on port 1500, requests are newline terminated words
+class TcpSession : public ClientSession
+{
+    Q_OBJECT
+
+public:
+    explicit TcpSession(QTcpSocket* aSocket, QObject *parent = 0);
+    ~TcpSession();
+
+    void send(const QString& aFrame);
+    QString peerName() const;
+
+private slots:
+    void readRequests();
+    void handleDisconnected();
+
+private:
+    void emitRequest(const QByteArray& aData);
+    void timerEvent(QTimerEvent *aEvent);
+
+private:
+    QTcpSocket* mSocket;
+    QByteArray mPending;        // received after the last newline
+    QBasicTimer mIdleTimer;     // an unterminated request is taken as a legacy one when this fires
+};
+
+#endif // CLIENTSESSION_H
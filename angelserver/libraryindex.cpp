@@ -0,0 +1,444 @@
+#include <QtCore>
+#include <QtConcurrentRun>
+#include <QTextDocument>
+#include <QDebug>
+#include <algorithm>
+#include "libraryindex.h"
+
+const QString KEntryElement     = "entry";
+const QString KTypeAttribute    = "type";
+const QString KSongType         = "song";
+const QString KTitleElement     = "title";
+const QString KArtistElement    = "artist";
+const QString KAlbumElement     = "album";
+const QString KLocationElement  = "location";
+const QString KTrackTemplate    = "<track location=\"%1\" artist=\"%2\" album=\"%3\">%4</track>";
+const QString KPageTemplate     = "<library version=\"%1\" total=\"%2\" next=\"%3\">%4</library>";
+const QString KChangesTemplate  = "<changes from=\"%1\" version=\"%2\" reset=\"%3\">%4</changes>";
+const QString KRemovedTemplate  = "<removed location=\"%1\"/>";
+
+const int KMaxPageSize = 200;
+const int KMaxDeltaHistory = 32;
+const int KMaxChangesInResponse = 500;
+const int KRebuildDelayInMs = 2000;
+const QString KArtistTitleSeparator = " - ";
+
+// Orders track indexes case insensitively on one field of the track
+struct TrackLess
+{
+    TrackLess(const QVector<LibraryTrack>& aTracks, QString LibraryTrack::* aField)
+        : tracks(aTracks), field(aField) {}
+    bool operator()(int aLeft, int aRight) const
+    {
+        int result = QString::compare(tracks.at(aLeft).*field,tracks.at(aRight).*field,Qt::CaseInsensitive);
+        if(0 == result)
+        {
+            return tracks.at(aLeft).location < tracks.at(aRight).location;
+        }
+        return result < 0;
+    }
+    const QVector<LibraryTrack>& tracks;
+    QString LibraryTrack::* field;
+};
+
+// Compares only the first prefix.length() characters so that lower_bound and
+// upper_bound give the range of tracks starting with the prefix
+struct PrefixLess
+{
+    PrefixLess(const QVector<LibraryTrack>& aTracks, QString LibraryTrack::* aField)
+        : tracks(aTracks), field(aField) {}
+    int compare(int aIndex, const QString& aPrefix) const
+    {
+        const QString& value = tracks.at(aIndex).*field;
+        return QStringRef(&value,0,qMin(aPrefix.length(),value.length())).compare(aPrefix,Qt::CaseInsensitive);
+    }
+    bool operator()(int aIndex, const QString& aPrefix) const { return compare(aIndex,aPrefix) < 0; }
+    bool operator()(const QString& aPrefix, int aIndex) const { return compare(aIndex,aPrefix) > 0; }
+    const QVector<LibraryTrack>& tracks;
+    QString LibraryTrack::* field;
+};
+
+LibraryIndex::LibraryIndex(QObject *parent)
+:   QObject(parent), mRebuildPending(false), mVersion(0)
+{
+    mWatcher = new QFileSystemWatcher(this);
+    connect(mWatcher,SIGNAL(fileChanged(QString)),this,SLOT(sourceChanged()));
+    connect(mWatcher,SIGNAL(directoryChanged(QString)),this,SLOT(sourceChanged()));
+
+    // Players rewrite their database in bursts, build once it settles
+    mRebuildTimer = new QTimer(this);
+    mRebuildTimer->setSingleShot(true);
+    connect(mRebuildTimer,SIGNAL(timeout()),this,SLOT(rebuild()));
+
+    connect(&mBuild,SIGNAL(finished()),this,SLOT(buildFinished()));
+}
+
+LibraryIndex::~LibraryIndex()
+{
+    mBuild.waitForFinished();
+}
+
+void LibraryIndex::setSources(QString aDatabase, QString aMusicFolder)
+{
+    mDatabase = aDatabase;
+    mMusicFolder = aMusicFolder;
+    if(!mWatcher->files().isEmpty())
+    {
+        mWatcher->removePaths(mWatcher->files());
+    }
+    if(!mWatcher->directories().isEmpty())
+    {
+        mWatcher->removePaths(mWatcher->directories());
+    }
+    rebuild();
+}
+
+int LibraryIndex::version() const
+{
+    return mVersion;
+}
+
+int LibraryIndex::count() const
+{
+    return mSnapshot.tracks.count();
+}
+
+void LibraryIndex::sourceChanged()
+{
+    mRebuildTimer->start(KRebuildDelayInMs);
+}
+
+void LibraryIndex::rebuild()
+{
+    if(mBuild.isRunning())
+    {
+        mRebuildPending = true;
+        return;
+    }
+
+    // The database is usually replaced rather than written, which drops the watch
+    if(QFile::exists(mDatabase) && !mWatcher->files().contains(mDatabase))
+    {
+        mWatcher->addPath(mDatabase);
+    }
+    else if(!QFile::exists(mDatabase) && QFile::exists(mMusicFolder) &&
+            !mWatcher->directories().contains(mMusicFolder))
+    {
+        mWatcher->addPath(mMusicFolder);
+    }
+
+    mBuild.setFuture(QtConcurrent::run(&LibraryIndex::build,mDatabase,mMusicFolder,mSnapshot.tracks));
+}
+
+void LibraryIndex::buildFinished()
+{
+    LibrarySnapshot snapshot = mBuild.result();
+    if(0 < mVersion && snapshot.added.isEmpty() && snapshot.removed.isEmpty())
+    {
+        qDebug()<<"library unchanged";
+    }
+    else
+    {
+        ++mVersion;
+        LibraryDelta delta;
+        delta.version = mVersion;
+        delta.added = snapshot.added;
+        delta.removed = snapshot.removed;
+        snapshot.added.clear();
+        snapshot.removed.clear();
+        mHistory.append(delta);
+        while(KMaxDeltaHistory < mHistory.count())
+        {
+            mHistory.removeFirst();
+        }
+        mSnapshot = snapshot;
+        qDebug()<<"library version"<<mVersion<<"tracks"<<mSnapshot.tracks.count();
+        emit versionChanged(mVersion);
+    }
+
+    if(mRebuildPending)
+    {
+        mRebuildPending = false;
+        rebuild();
+    }
+}
+
+LibrarySnapshot LibraryIndex::build(QString aDatabase, QString aMusicFolder, QVector<LibraryTrack> aPrevious)
+{
+    LibrarySnapshot snapshot;
+    if(QFile::exists(aDatabase))
+    {
+        readDatabase(aDatabase,snapshot.tracks);
+    }
+    else if(!aMusicFolder.isEmpty())
+    {
+        scanFolder(aMusicFolder,snapshot.tracks);
+    }
+
+    int count = snapshot.tracks.count();
+    snapshot.byTitle.resize(count);
+    for(int i = 0; i < count; ++i)
+    {
+        snapshot.byTitle[i] = i;
+    }
+    snapshot.byArtist = snapshot.byTitle;
+    snapshot.locations.reserve(count);
+    for(int i = 0; i < count; ++i)
+    {
+        snapshot.locations.insert(snapshot.tracks.at(i).location);
+    }
+    qSort(snapshot.byTitle.begin(),snapshot.byTitle.end(),TrackLess(snapshot.tracks,&LibraryTrack::title));
+    qSort(snapshot.byArtist.begin(),snapshot.byArtist.end(),TrackLess(snapshot.tracks,&LibraryTrack::artist));
+
+    // Work out the delta against the previous build
+    QHash<QString,int> previous;
+    previous.reserve(aPrevious.count());
+    for(int i = 0; i < aPrevious.count(); ++i)
+    {
+        previous.insert(aPrevious.at(i).location,i);
+    }
+    for(int i = 0; i < count; ++i)
+    {
+        const LibraryTrack& track = snapshot.tracks.at(i);
+        QHash<QString,int>::iterator found = previous.find(track.location);
+        if(previous.end() == found)
+        {
+            snapshot.added.append(track);
+            continue;
+        }
+        const LibraryTrack& old = aPrevious.at(found.value());
+        if(old.title != track.title || old.artist != track.artist || old.album != track.album)
+        {
+            snapshot.added.append(track);
+        }
+        previous.erase(found);
+    }
+    snapshot.removed = previous.keys();
+    return snapshot;
+}
+
+void LibraryIndex::readDatabase(QString aDatabase, QVector<LibraryTrack>& aTracks)
+{
+    QFile file(aDatabase);
+    if(!file.open(QIODevice::ReadOnly))
+    {
+        return;
+    }
+    QXmlStreamReader reader(&file);
+    LibraryTrack track;
+    bool isSong = false;
+    while(!reader.atEnd())
+    {
+        reader.readNext();
+        if(reader.isStartElement())
+        {
+            if(reader.name() == KEntryElement)
+            {
+                isSong = (reader.attributes().value(KTypeAttribute) == KSongType);
+                track = LibraryTrack();
+            }
+            else if(isSong && reader.name() == KTitleElement)
+            {
+                track.title = reader.readElementText();
+            }
+            else if(isSong && reader.name() == KArtistElement)
+            {
+                track.artist = reader.readElementText();
+            }
+            else if(isSong && reader.name() == KAlbumElement)
+            {
+                track.album = reader.readElementText();
+            }
+            else if(isSong && reader.name() == KLocationElement)
+            {
+                track.location = reader.readElementText();
+            }
+        }
+        else if(reader.isEndElement() && reader.name() == KEntryElement)
+        {
+            if(isSong && !track.location.isEmpty())
+            {
+                aTracks.append(track);
+            }
+            isSong = false;
+        }
+    }
+    if(reader.hasError())
+    {
+        qDebug()<<"library database error:"<<reader.errorString();
+    }
+}
+
+void LibraryIndex::scanFolder(QString aMusicFolder, QVector<LibraryTrack>& aTracks)
+{
+    // Stand-in for players without a database: <artist>/<album>/<title>.<ext>
+    QStringList filters;
+    filters<<"*.mp3"<<"*.ogg"<<"*.oga"<<"*.flac"<<"*.m4a"<<"*.wma"<<"*.wav";
+    QDirIterator it(aMusicFolder,filters,QDir::Files,
+                    QDirIterator::Subdirectories | QDirIterator::FollowSymlinks);
+    while(it.hasNext())
+    {
+        it.next();
+        QFileInfo info = it.fileInfo();
+        LibraryTrack track;
+        track.title = info.completeBaseName();
+        track.album = info.dir().dirName();
+        QDir artistDir = info.dir();
+        if(artistDir.cdUp())
+        {
+            track.artist = artistDir.dirName();
+        }
+        track.location = QUrl::fromLocalFile(info.absoluteFilePath()).toString();
+        aTracks.append(track);
+    }
+}
+
+QString LibraryIndex::trackElement(const LibraryTrack& aTrack) const
+{
+    // single pass, locations are percent encoded
+    return KTrackTemplate.arg(Qt::escape(aTrack.location),Qt::escape(aTrack.artist),
+                              Qt::escape(aTrack.album),Qt::escape(aTrack.title));
+}
+
+QString LibraryIndex::browse(int aCursor, int aCount) const
+{
+    const QVector<int>& order = mSnapshot.byTitle;
+    int begin = qBound(0,aCursor,order.count());
+    int end = qMin(order.count(),begin+qBound(1,aCount,KMaxPageSize));
+    QString tracks;
+    for(int i = begin; i < end; ++i)
+    {
+        tracks.append(trackElement(mSnapshot.tracks.at(order.at(i))));
+    }
+    int next = (end < order.count())?(end):(-1);
+    return KPageTemplate.arg(mVersion).arg(order.count()).arg(next).arg(tracks);
+}
+
+QString LibraryIndex::search(QString aPrefix, int aCursor, int aCount) const
+{
+    // Matches are the title range followed by the artist range, the cursor is a
+    // position in that sequence so it stays valid across pages of one version
+    const QVector<LibraryTrack>& tracks = mSnapshot.tracks;
+    PrefixLess byTitle(tracks,&LibraryTrack::title);
+    PrefixLess byArtist(tracks,&LibraryTrack::artist);
+    const int* titleBegin = std::lower_bound(mSnapshot.byTitle.constBegin(),mSnapshot.byTitle.constEnd(),aPrefix,byTitle);
+    const int* titleEnd = std::upper_bound(titleBegin,mSnapshot.byTitle.constEnd(),aPrefix,byTitle);
+    const int* artistBegin = std::lower_bound(mSnapshot.byArtist.constBegin(),mSnapshot.byArtist.constEnd(),aPrefix,byArtist);
+    const int* artistEnd = std::upper_bound(artistBegin,mSnapshot.byArtist.constEnd(),aPrefix,byArtist);
+    int titleMatches = titleEnd-titleBegin;
+    int total = titleMatches + (artistEnd-artistBegin);
+
+    int position = qBound(0,aCursor,total);
+    int count = qBound(1,aCount,KMaxPageSize);
+    QString result;
+    for(; position < total && 0 < count; ++position)
+    {
+        if(position < titleMatches)
+        {
+            result.append(trackElement(tracks.at(titleBegin[position])));
+            --count;
+            continue;
+        }
+        int index = artistBegin[position-titleMatches];
+        // already listed in the title range
+        if(0 == byTitle.compare(index,aPrefix))
+        {
+            continue;
+        }
+        result.append(trackElement(tracks.at(index)));
+        --count;
+    }
+    int next = (position < total)?(position):(-1);
+    return KPageTemplate.arg(mVersion).arg(total).arg(next).arg(result);
+}
+
+QString LibraryIndex::changes(int aSinceVersion) const
+{
+    if(aSinceVersion >= mVersion)
+    {
+        return KChangesTemplate.arg(aSinceVersion).arg(mVersion).arg(0).arg(QString());
+    }
+    // Too old for the history we keep, the client has to browse again
+    if(0 >= aSinceVersion || mHistory.isEmpty() || mHistory.first().version > aSinceVersion+1)
+    {
+        return KChangesTemplate.arg(aSinceVersion).arg(mVersion).arg(1).arg(QString());
+    }
+
+    QHash<QString,LibraryTrack> added;
+    QSet<QString> removed;
+    foreach(const LibraryDelta& delta, mHistory)
+    {
+        if(delta.version <= aSinceVersion)
+        {
+            continue;
+        }
+        foreach(const QString& location, delta.removed)
+        {
+            added.remove(location);
+            removed.insert(location);
+        }
+        foreach(const LibraryTrack& track, delta.added)
+        {
+            removed.remove(track.location);
+            added.insert(track.location,track);
+        }
+    }
+    if(KMaxChangesInResponse < added.count()+removed.count())
+    {
+        return KChangesTemplate.arg(aSinceVersion).arg(mVersion).arg(1).arg(QString());
+    }
+
+    QString result;
+    foreach(const LibraryTrack& track, added)
+    {
+        result.append(trackElement(track));
+    }
+    foreach(const QString& location, removed)
+    {
+        result.append(KRemovedTemplate.arg(Qt::escape(location)));
+    }
+    return KChangesTemplate.arg(aSinceVersion).arg(mVersion).arg(0).arg(result);
+}
+
+bool LibraryIndex::contains(QString aLocation) const
+{
+    return mSnapshot.locations.contains(aLocation);
+}
+
+QString LibraryIndex::locationOf(QString aNowPlaying) const
+{
+    // The player prints "artist - title", a title alone is matched as well
+    QString artist;
+    QString title = aNowPlaying;
+    int separator = aNowPlaying.indexOf(KArtistTitleSeparator);
+    if(0 < separator)
+    {
+        artist = aNowPlaying.left(separator);
+        title = aNowPlaying.mid(separator+KArtistTitleSeparator.length());
+    }
+
+    const QVector<LibraryTrack>& tracks = mSnapshot.tracks;
+    PrefixLess byTitle(tracks,&LibraryTrack::title);
+    const int* begin = std::lower_bound(mSnapshot.byTitle.constBegin(),mSnapshot.byTitle.constEnd(),title,byTitle);
+    const int* end = std::upper_bound(begin,mSnapshot.byTitle.constEnd(),title,byTitle);
+    QString fallback;
+    for(const int* it = begin; it != end; ++it)
+    {
+        const LibraryTrack& track = tracks.at(*it);
+        if(0 != QString::compare(track.title,title,Qt::CaseInsensitive))
+        {
+            continue;
+        }
+        if(artist.isEmpty() || 0 == QString::compare(track.artist,artist,Qt::CaseInsensitive))
+        {
+            return track.location;
+        }
+        if(fallback.isEmpty())
+        {
+            fallback = track.location;
+        }
+    }
+    return fallback;
+}
+
+//eof
@@ -0,0 +1,90 @@
+#ifndef LIBRARYINDEX_H
+#define LIBRARYINDEX_H
+
+#include <QObject>
+#include <QVector>
+#include <QStringList>
+#include <QSet>
+#include <QFutureWatcher>
+
+class QFileSystemWatcher;
+class QTimer;
+
+struct LibraryTrack
+{
+    QString title;
+    QString artist;
+    QString album;
+    QString location;   // uri handed to the player for enqueue
+};
+
+// One build of the library, byTitle and byArtist hold track indexes in sorted order
+struct LibrarySnapshot
+{
+    QVector<LibraryTrack> tracks;
+    QVector<int> byTitle;
+    QVector<int> byArtist;
+    QSet<QString> locations;        // every track location, for enqueue checks
+    QVector<LibraryTrack> added;    // added or changed since the previous build
+    QStringList removed;
+};
+
+// Changes that took the library from version-1 to version
+struct LibraryDelta
+{
+    int version;
+    QVector<LibraryTrack> added;    // added or changed
+    QStringList removed;
+};
+
+// Server side index of the player library, built from the player database or
+// from a scan of the music folder when the player has none. Building runs on a
+// worker thread, requests are always answered from the last complete build.
+class LibraryIndex : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit LibraryIndex(QObject *parent = 0);
+    ~LibraryIndex();
+
+    void setSources(QString aDatabase, QString aMusicFolder);
+    int version() const;
+    int count() const;
+
+    QString browse(int aCursor, int aCount) const;
+    QString search(QString aPrefix, int aCursor, int aCount) const;
+    QString changes(int aSinceVersion) const;
+    QString locationOf(QString aNowPlaying) const;
+    bool contains(QString aLocation) const;
+
+signals:
+    void versionChanged(int aVersion);
+
+public slots:
+    void rebuild();
+
+private slots:
+    void buildFinished();
+    void sourceChanged();
+
+private:
+    static LibrarySnapshot build(QString aDatabase, QString aMusicFolder, QVector<LibraryTrack> aPrevious);
+    static void readDatabase(QString aDatabase, QVector<LibraryTrack>& aTracks);
+    static void scanFolder(QString aMusicFolder, QVector<LibraryTrack>& aTracks);
+    QString trackElement(const LibraryTrack& aTrack) const;
+
+private:
+    QString mDatabase;
+    QString mMusicFolder;
+    QFileSystemWatcher* mWatcher;
+    QTimer* mRebuildTimer;
+    QFutureWatcher<LibrarySnapshot> mBuild;
+    bool mRebuildPending;
+
+    int mVersion;
+    LibrarySnapshot mSnapshot;
+    QList<LibraryDelta> mHistory;
+};
+
+#endif // LIBRARYINDEX_H
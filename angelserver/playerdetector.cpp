@@ -0,0 +1,389 @@
+#include <QtCore>
+#include <QDesktopServices>
+#include <QDebug>
+#include "playerdetector.h"
+
+const QString KCommandsElement  = "commands";
+const QString KOperationElement = "operation";
+const QString KOptionElement    = "option";
+const QString KPlayerAttribute  = "player";
+const QString KCommandAttribute = "command";
+const QString KProcessAttribute = "process";
+const QString KDBusAttribute    = "dbus";
+const QString KLibraryAttribute = "library";
+const QString KIdAttribute      = "id";
+const QString KTimeoutAttribute = "timeout";
+const QString KArgumentAttribute = "argument";
+const QString KCacheFileName    = "players.cache";
+const QString KDBusHasOwner     = "dbus-send --session --print-reply --dest=org.freedesktop.DBus /org/freedesktop/DBus org.freedesktop.DBus.NameHasOwner string:%1";
+const QString KDBusOwnerFound   = "boolean true";
+#ifdef Q_OS_WIN
+const QString KProcessRunning   = "tasklist /NH /FI \"IMAGENAME eq %1\"";
+const QChar KPathSeparator      = ';';
+const QString KExecutableSuffix = ".exe";
+#else
+const QString KProcessRunning   = "pidof %1";
+const QChar KPathSeparator      = ':';
+const QString KExecutableSuffix = "";
+#endif
+
+const quint32 KCacheMagic = 0xA9E1CAC4;
+const qint32 KCacheVersion = 4;
+const int KProbeTimeoutInMs = 1500;
+
+// Only what stays true between starts, whether a player runs is probed every time
+QDataStream& operator<<(QDataStream& aStream, const PlayerInfo& aInfo)
+{
+    aStream<<aInfo.name<<aInfo.command<<aInfo.processName<<aInfo.dbusName<<aInfo.library
+           <<aInfo.executablePath<<aInfo.executableModified
+           <<aInfo.installed<<aInfo.options<<aInfo.timeouts<<aInfo.argumentOperations;
+    return aStream;
+}
+
+QDataStream& operator>>(QDataStream& aStream, PlayerInfo& aInfo)
+{
+    aStream>>aInfo.name>>aInfo.command>>aInfo.processName>>aInfo.dbusName>>aInfo.library
+           >>aInfo.executablePath>>aInfo.executableModified
+           >>aInfo.installed>>aInfo.options>>aInfo.timeouts>>aInfo.argumentOperations;
+    return aStream;
+}
+
+PlayerDetector::PlayerDetector(QObject *parent)
+:   QObject(parent), mActivePlayer(-1), mFromCache(false)
+{
+    mProbeTimer = new QTimer(this);
+    mProbeTimer->setSingleShot(true);
+    connect(mProbeTimer,SIGNAL(timeout()),this,SLOT(probeTimedOut()));
+}
+
+PlayerDetector::~PlayerDetector()
+{
+}
+
+void PlayerDetector::detect(QIODevice* aCommands)
+{
+    mPlayers.clear();
+    mActivePlayer = -1;
+
+    // The cache spares parsing the xml and searching PATH, nothing more
+    mFromCache = loadCache();
+    if(mFromCache)
+    {
+        qDebug()<<"players from cache:"<<mPlayers.count();
+    }
+    else
+    {
+        if(!readCommands(aCommands))
+        {
+            finishDetection();
+            return;
+        }
+        for(int i = 0; i < mPlayers.count(); ++i)
+        {
+            PlayerInfo& info = mPlayers[i];
+            QString program = info.command.section(' ',0,0,QString::SectionSkipEmpty);
+            info.executablePath = findExecutable(program);
+            info.installed = !info.executablePath.isEmpty();
+            if(info.installed)
+            {
+                info.executableModified = QFileInfo(info.executablePath).lastModified();
+            }
+        }
+    }
+
+    // Which player runs changes between starts, so that is probed every time.
+    // Every probe is started before waiting on any of them.
+    for(int i = 0; i < mPlayers.count(); ++i)
+    {
+        PlayerInfo& info = mPlayers[i];
+        info.running = false;
+        if(!info.installed)
+        {
+            continue;
+        }
+        if(!info.processName.isEmpty())
+        {
+#ifdef Q_OS_WIN
+            startProbe(i,KProcessRunning.arg(info.processName),info.processName);
+#else
+            startProbe(i,KProcessRunning.arg(info.processName),QString());
+#endif
+        }
+        else if(!info.dbusName.isEmpty())
+        {
+            startProbe(i,KDBusHasOwner.arg(info.dbusName),KDBusOwnerFound);
+        }
+    }
+
+    if(mProbes.isEmpty())
+    {
+        finishDetection();
+        return;
+    }
+    mProbeTimer->start(KProbeTimeoutInMs);
+}
+
+const PlayerInfo* PlayerDetector::activePlayer() const
+{
+    if(0 > mActivePlayer)
+    {
+        return 0;
+    }
+    return &mPlayers.at(mActivePlayer);
+}
+
+const PlayerInfo* PlayerDetector::player(QString aPlayerName) const
+{
+    for(int i = 0; i < mPlayers.count(); ++i)
+    {
+        if(aPlayerName == mPlayers.at(i).name)
+        {
+            return &mPlayers.at(i);
+        }
+    }
+    return 0;
+}
+
+bool PlayerDetector::readCommands(QIODevice* aCommands)
+{
+    aCommands->reset();
+    QXmlStreamReader reader(aCommands);
+    PlayerInfo info;
+    QString operation;
+    while(!reader.atEnd())
+    {
+        reader.readNext();
+        if(reader.isStartElement())
+        {
+            QXmlStreamAttributes attributes = reader.attributes();
+            if(reader.name() == KCommandsElement)
+            {
+                info = PlayerInfo();
+                info.name = attributes.value(KPlayerAttribute).toString();
+                info.command = attributes.value(KCommandAttribute).toString();
+                info.processName = attributes.value(KProcessAttribute).toString();
+                info.dbusName = attributes.value(KDBusAttribute).toString();
+                info.library = attributes.value(KLibraryAttribute).toString();
+            }
+            else if(reader.name() == KOperationElement)
+            {
+                operation = attributes.value(KIdAttribute).toString();
+                int timeout = attributes.value(KTimeoutAttribute).toString().toInt();
+                if(0 < timeout)
+                {
+                    info.timeouts.insert(operation,timeout);
+                }
+                // argument="..." names what the client passes, e.g. a location to enqueue
+                if(!attributes.value(KArgumentAttribute).isEmpty())
+                {
+                    info.argumentOperations.append(operation);
+                }
+            }
+            else if(reader.name() == KOptionElement)
+            {
+                info.options.insert(operation,reader.readElementText().simplified());
+            }
+        }
+        else if(reader.isEndElement() && reader.name() == KCommandsElement)
+        {
+            mPlayers.append(info);
+        }
+    }
+
+    if(reader.hasError())
+    {
+        qDebug()<<"commands xml error:"<<reader.errorString();
+        mPlayers.clear();
+        return false;
+    }
+    return !mPlayers.isEmpty();
+}
+
+QString PlayerDetector::findExecutable(QString aProgram)
+{
+    // The player cli may ship next to the server, eg. clamp on windows
+    QStringList dirs;
+    dirs<<QCoreApplication::applicationDirPath();
+    dirs<<QString::fromLocal8Bit(qgetenv("PATH")).split(KPathSeparator,QString::SkipEmptyParts);
+    foreach(QString dir, dirs)
+    {
+        QFileInfo info(QDir(dir),aProgram+KExecutableSuffix);
+        if(info.isFile() && info.isExecutable())
+        {
+            return info.absoluteFilePath();
+        }
+    }
+    return QString();
+}
+
+void PlayerDetector::startProbe(int aPlayerIndex, QString aCommand, QString aExpectedOutput)
+{
+    qDebug()<<__FUNCTION__<<aCommand;
+    QProcess* probe = new QProcess(this);
+    mProbes.insert(probe,aPlayerIndex);
+    mExpectedOutputs.insert(probe,aExpectedOutput);
+    connect(probe,SIGNAL(finished(int,QProcess::ExitStatus)),this,SLOT(probeFinished(int,QProcess::ExitStatus)));
+    connect(probe,SIGNAL(error(QProcess::ProcessError)),this,SLOT(probeError(QProcess::ProcessError)));
+    probe->start(aCommand);
+}
+
+void PlayerDetector::probeFinished(int aExitCode, QProcess::ExitStatus aExitStatus)
+{
+    QProcess* probe = qobject_cast<QProcess*>(sender());
+    if(!probe || !mProbes.contains(probe))
+    {
+        return;
+    }
+    QString output = QString::fromLocal8Bit(probe->readAllStandardOutput());
+    QString expected = mExpectedOutputs.value(probe);
+    bool found = 0 == aExitCode && QProcess::NormalExit == aExitStatus &&
+                 (expected.isEmpty() || output.contains(expected,Qt::CaseInsensitive));
+    completeProbe(probe,found);
+}
+
+void PlayerDetector::probeError(QProcess::ProcessError aError)
+{
+    // A probe tool which is missing never reaches probeFinished()
+    QProcess* probe = qobject_cast<QProcess*>(sender());
+    if(!probe || !mProbes.contains(probe) || QProcess::FailedToStart != aError)
+    {
+        return;
+    }
+    completeProbe(probe,false);
+}
+
+void PlayerDetector::completeProbe(QProcess* aProbe, bool aFound)
+{
+    int index = mProbes.take(aProbe);
+    mExpectedOutputs.remove(aProbe);
+    aProbe->deleteLater();
+    if(aFound)
+    {
+        mPlayers[index].running = true;
+    }
+
+    if(mProbes.isEmpty())
+    {
+        mProbeTimer->stop();
+        finishDetection();
+    }
+}
+
+void PlayerDetector::probeTimedOut()
+{
+    qDebug()<<__FUNCTION__<<mProbes.count();
+    foreach(QProcess* probe, mProbes.keys())
+    {
+        probe->blockSignals(true);
+        probe->kill();
+        probe->waitForFinished(100);
+        probe->deleteLater();
+    }
+    mProbes.clear();
+    mExpectedOutputs.clear();
+    finishDetection();
+}
+
+void PlayerDetector::finishDetection()
+{
+    // Prefer a running player, otherwise the first installed one in xml order
+    mActivePlayer = -1;
+    for(int i = 0; i < mPlayers.count() && 0 > mActivePlayer; ++i)
+    {
+        if(mPlayers.at(i).installed && mPlayers.at(i).running)
+        {
+            mActivePlayer = i;
+        }
+    }
+    for(int i = 0; i < mPlayers.count() && 0 > mActivePlayer; ++i)
+    {
+        if(mPlayers.at(i).installed)
+        {
+            mActivePlayer = i;
+        }
+    }
+    qDebug()<<__FUNCTION__<<"active:"<<mActivePlayer;
+
+    if(!mFromCache && !mPlayers.isEmpty())
+    {
+        saveCache();
+    }
+    emit detectionFinished();
+}
+
+QString PlayerDetector::cacheFileName()
+{
+    QString dir = QDesktopServices::storageLocation(QDesktopServices::CacheLocation);
+    QDir().mkpath(dir);
+    return QDir(dir).filePath(KCacheFileName);
+}
+
+bool PlayerDetector::loadCache()
+{
+    QFile file(cacheFileName());
+    if(!file.open(QIODevice::ReadOnly))
+    {
+        return false;
+    }
+    QDataStream in(&file);
+    in.setVersion(QDataStream::Qt_4_0);
+
+    quint32 magic = 0;
+    qint32 version = 0;
+    QDateTime serverModified;
+    QString path;
+    QList<PlayerInfo> players;
+    in>>magic>>version;
+    if(KCacheMagic != magic || KCacheVersion != version)
+    {
+        return false;
+    }
+    in>>serverModified>>path>>players;
+    if(QDataStream::Ok != in.status())
+    {
+        return false;
+    }
+
+    // The xml is compiled in, so a rebuilt server or a changed PATH invalidates the cache
+    if(serverModified != QFileInfo(QCoreApplication::applicationFilePath()).lastModified() ||
+       path != QString::fromLocal8Bit(qgetenv("PATH")))
+    {
+        return false;
+    }
+    // A removed or updated player shows in its mtime, one installed since the
+    // cache was written only in another lookup
+    foreach(const PlayerInfo& info, players)
+    {
+        if(info.installed &&
+           info.executableModified != QFileInfo(info.executablePath).lastModified())
+        {
+            return false;
+        }
+        if(!info.installed &&
+           !findExecutable(info.command.section(' ',0,0,QString::SectionSkipEmpty)).isEmpty())
+        {
+            qDebug()<<"player installed since the cache was written:"<<info.name;
+            return false;
+        }
+    }
+    mPlayers = players;
+    return true;
+}
+
+void PlayerDetector::saveCache()
+{
+    QFile file(cacheFileName());
+    if(!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+    {
+        qDebug()<<"cannot write player cache:"<<file.errorString();
+        return;
+    }
+    QDataStream out(&file);
+    out.setVersion(QDataStream::Qt_4_0);
+    out<<KCacheMagic<<KCacheVersion
+       <<QFileInfo(QCoreApplication::applicationFilePath()).lastModified()
+       <<QString::fromLocal8Bit(qgetenv("PATH"))
+       <<mPlayers;
+}
+
+//eof
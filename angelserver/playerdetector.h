@@ -0,0 +1,83 @@
+#ifndef PLAYERDETECTOR_H
+#define PLAYERDETECTOR_H
+
+#include <QObject>
+#include <QProcess>
+#include <QHash>
+#include <QList>
+#include <QDateTime>
+#include <QStringList>
+
+class QTimer;
+class QIODevice;
+class QDataStream;
+
+// A player configured in the commands xml and what was found about it on this box
+struct PlayerInfo
+{
+    PlayerInfo() : installed(false), running(false) {}
+    bool supports(const QString& aOperation) const { return options.contains(aOperation); }
+    bool acceptsArguments(const QString& aOperation) const { return argumentOperations.contains(aOperation); }
+
+    QString name;
+    QString command;
+    QString processName;
+    QString dbusName;
+    QString library;                  // player database the library index is built from
+    QString executablePath;
+    QDateTime executableModified;
+    bool installed;
+    bool running;                     // probed on every start, never cached
+    QHash<QString,QString> options;   // operation id -> command line option
+    QHash<QString,int> timeouts;      // operation id -> timeout in ms
+    QStringList argumentOperations;   // operations that take an argument from the client
+};
+
+QDataStream& operator<<(QDataStream& aStream, const PlayerInfo& aInfo);
+QDataStream& operator>>(QDataStream& aStream, PlayerInfo& aInfo);
+
+// Finds the players configured in the commands xml which are usable on this box.
+// Where each player's executable is gets cached on disk and stays valid while the
+// executables are unchanged. Which players run is probed on every start, all at once
+// (running process, or the D-Bus name for players without a process name).
+class PlayerDetector : public QObject
+{
+    Q_OBJECT
+    friend class ProtocolBench;
+
+public:
+    explicit PlayerDetector(QObject *parent = 0);
+    ~PlayerDetector();
+
+    void detect(QIODevice* aCommands);
+    const PlayerInfo* activePlayer() const;
+    const PlayerInfo* player(QString aPlayerName) const;
+
+signals:
+    void detectionFinished();
+
+private slots:
+    void probeFinished(int aExitCode, QProcess::ExitStatus aExitStatus);
+    void probeError(QProcess::ProcessError aError);
+    void probeTimedOut();
+
+private:
+    bool readCommands(QIODevice* aCommands);
+    bool loadCache();
+    void saveCache();
+    QString cacheFileName();
+    QString findExecutable(QString aProgram);
+    void startProbe(int aPlayerIndex, QString aCommand, QString aExpectedOutput);
+    void completeProbe(QProcess* aProbe, bool aFound);
+    void finishDetection();
+
+private:
+    QList<PlayerInfo> mPlayers;
+    QHash<QProcess*,int> mProbes;               // running probe -> player index
+    QHash<QProcess*,QString> mExpectedOutputs;  // running probe -> text that marks success
+    QTimer* mProbeTimer;
+    int mActivePlayer;
+    bool mFromCache;
+};
+
+#endif // PLAYERDETECTOR_H
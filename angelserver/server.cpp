@@ -1,234 +1,755 @@
-#include <QtGui>
-#include <QtNetwork>
-#include <QDebug>
-#include <QProcess>
-#include <stdlib.h>
-#include <QXmlQuery>
-#include "server.h"
-
-const QString KXmlFileName      = "xmlfilename";
-const QString KId               = "id";
-const QString KSource           = "source";
-const QString KPlayer           = "player";
-const QString KXqReadCommandForPlayer = "let $root:=doc($xmlfilename)//commands where $root/@player=$player return data($root/@command)";
-const QString KXqReadOption     = "let $root:=doc($xmlfilename)//commands for $operation in $root/operation where $operation/@id=$id return data($operation/option)";
-const QString KLinuxCommandFileName = "linux_commands.xml";
-const QString KWindowsCommandFileName = "win_commands.xml";
-const QString KRhythmbox        = "rhythmbox";
-const QString KWinamp           = "winamp";
-const QString KNowPlaying       = "nowplaying";
-const QString KPlay             = "play";
-const QString KSyncNow          = "syncnow";
-const QString KConnect          = "connect";
-const QString KResponseTemplate = "<response><status>%1</status><request>%2</request><text>%3</text></response>";
-
-const int KStatusSuccess =  200;
-const int KStatusInternalError = 500;
-const int KOneSecondInMs = 1000;
-
-Server::Server(QWidget *parent)
-:   QDialog(parent), tcpServer(0), networkSession(0),
-    mInternalSync(false)
-{
-    statusLabel = new QLabel;
-    quitButton = new QPushButton(tr("Quit"));
-    quitButton->setAutoDefault(false);
-    mCurrentTrackName.clear();
-    mProcess = new QProcess(this);
-    mXmlQuery = new QXmlQuery;
-    mCurrentRequest.clear();
-    connect(mProcess,SIGNAL(finished(int,QProcess::ExitStatus)),this,SLOT(processFinished(int,QProcess::ExitStatus)));
-
-// Populate command filename depending on the underlying platform
-    QString commandsFileName;
-#ifdef Q_OS_LINUX
-    commandsFileName = ":/xml/linux_commands.xml";
-    // TODO: Add support to get the player name dynamically
-    mPlayerName = KRhythmbox;
-#else Q_OS_WIN32
-    commandsFileName = ":/xml/win_commands.xml";
-    mPlayerName = KWinamp;
-#endif
-
-    mCommands = new QFile(commandsFileName,this);
-    if(!mCommands->open(QIODevice::ReadOnly))
-    {
-
-    }
-
-    openSession();
-    connect(quitButton, SIGNAL(clicked()), this, SLOT(close()));
-    connect(tcpServer, SIGNAL(newConnection()), this, SLOT(handleNewConnection()));
-
-    QHBoxLayout *buttonLayout = new QHBoxLayout;
-    buttonLayout->addStretch(1);
-    buttonLayout->addWidget(quitButton);
-    buttonLayout->addStretch(1);
-
-    QVBoxLayout *mainLayout = new QVBoxLayout;
-    mainLayout->addWidget(statusLabel);
-    mainLayout->addLayout(buttonLayout);
-    setLayout(mainLayout);
-    setWindowTitle(tr("Angel Server"));
-}
-
-Server::~Server()
-{
-    delete mXmlQuery;
-}
-
-void Server::openSession()
-{
-    tcpServer = new QTcpServer(this);
-    if (!tcpServer->listen(QHostAddress::Any,1500)) {
-        QMessageBox::critical(this, tr("Angel Server"),
-                              tr("Unable to start the server: %1.")
-                              .arg(tcpServer->errorString()));
-        close();
-        return;
-    }
-
-    QString ipAddress;
-    QList<QHostAddress> ipAddressesList = QNetworkInterface::allAddresses();
-    // use the first non-localhost IPv4 address
-    for (int i = 0; i < ipAddressesList.size(); ++i) {
-        if (ipAddressesList.at(i) != QHostAddress::LocalHost &&
-            ipAddressesList.at(i).toIPv4Address()) {
-            ipAddress = ipAddressesList.at(i).toString();
-            break;
-        }
-    }
-    // if we did not find one, use IPv4 localhost
-    if (ipAddress.isEmpty())
-        ipAddress = QHostAddress(QHostAddress::LocalHost).toString();
-    statusLabel->setText(tr("The server is running on\n\nIP: %1\nport: %2\n\n"
-                            "Run the Angel Client now. \n"
-                            "In case of connection error, manually set IP and port and click connect in Angel Client")
-                         .arg(ipAddress).arg(tcpServer->serverPort()));
-}
-
-void Server::handleNewConnection()
-{
-    mCommandForPlayer = commandForPlayer(mPlayerName);
-    QByteArray response = "Conneted Successfully : "+mPlayerName.toLocal8Bit();
-
-    if(mCommandForPlayer.isEmpty())
-    {
-        response = "No supporting player!";
-    }
-    mClientConnection = tcpServer->nextPendingConnection();
-    connect(mClientConnection, SIGNAL(disconnected()),
-            mClientConnection, SLOT(deleteLater()));
-
-    connect(mClientConnection,SIGNAL(readyRead()),this,SLOT(handleRequest()));
-    sendResponse(KStatusSuccess,response);
-
-    // start sync timer
-    startTimer(KOneSecondInMs*4);
-}
-
-void Server::handleRequest()
-{
-    mCurrentRequest = mClientConnection->readAll().simplified();
-    qDebug()<<"requestFromClient: "<<mCurrentRequest;
-    executeCommand(mCurrentRequest);
-}
-
-void Server::executeCommand(QString aRequest)
-{
-    QString opt = option(aRequest);
-    QString commandToExecute = mCommandForPlayer+opt;
-    commandToExecute = commandToExecute.simplified();
-    qDebug()<<"commandToExecute:"<<commandToExecute;
-    mProcess->start(commandToExecute);
-}
-
-void Server::processFinished (int exitCode,QProcess::ExitStatus exitStatus)
-{
-qDebug()<<__FUNCTION__;
-    QString response = mProcess->readAllStandardOutput().simplified();
-
-    // check if sycn is required
-    if(mInternalSync)
-    {
-        mInternalSync = false;
-        qDebug()<<"sync required: "<<mCurrentTrackName<<" "<<response;
-        if(mCurrentTrackName != response)
-        {
-        mCurrentTrackName = response;
-        sync();
-        }
-
-    }
-
-    else
-    {
-    int stat = (0 == exitCode)?(KStatusSuccess):(KStatusInternalError);
-    sendResponse(stat,response);
-    }
-}
-
-void Server::readProcessOutput()
-{
-    qDebug()<<__FUNCTION__;
-    qDebug()<<mProcess->exitStatus();
-    qDebug()<<mProcess->exitCode();
-}
-
-void Server::timerEvent(QTimerEvent *event)
-{
-    checkIsSyncRequired();
-}
-
-void Server::checkIsSyncRequired()
-{
-    mInternalSync = true;
-    executeCommand(KNowPlaying); // check for track title
-}
-
-void Server::sync()
-{
-    sendResponse(KStatusSuccess,KSyncNow);
-}
-
-QString Server::commandForPlayer(QString aPlayerName)
-{
-    mCommands->reset();
-    QXmlQuery* xmlQuery = new QXmlQuery;
-    xmlQuery->bindVariable(KXmlFileName,mCommands);
-
-    xmlQuery->bindVariable(KPlayer,QVariant(aPlayerName));
-    xmlQuery->setQuery(KXqReadCommandForPlayer);
-    QString result = QString();
-    if(xmlQuery->isValid())
-    {
-        xmlQuery->evaluateTo(&result);
-    }
-    delete xmlQuery;
-    return result;
-}
-
-QString Server::option(QString aId)
-{
-    mCommands->reset();
-    mXmlQuery->bindVariable(KXmlFileName,mCommands);
-    mXmlQuery->bindVariable(KId,QVariant(aId));
-    mXmlQuery->setQuery(KXqReadOption);
-    QString result = QString();
-    if(mXmlQuery->isValid())
-    {
-       mXmlQuery->evaluateTo(&result);
-    }
-    qDebug()<<result;
-    return result;
-}
-
-void Server::sendResponse(int aStatus, QString aResponseText)
-{
-    qDebug()<<__FUNCTION__;
-    QString resp = KResponseTemplate.arg(aStatus).arg(mCurrentRequest).arg(aResponseText);
-    qDebug()<<resp;
-    mClientConnection->write(resp.toUtf8());
-}
-
-//eof
+#include <QtGui>
+#include <QtNetwork>
+#include <QDebug>
+#include <QProcess>
+#include <stdlib.h>
+#include "server.h"
+
+const QString KSource           = "source";
+const QString KLinuxCommandFileName = "linux_commands.xml";
+const QString KWindowsCommandFileName = "win_commands.xml";
+const QString KNowPlaying       = "nowplaying";
+const QString KPlay             = "play";
+const QString KSyncNow          = "syncnow";
+const QString KConnect          = "connect";
+const QString KBrowse           = "browse";
+const QString KSearch           = "search";
+const QString KLibraryChanges   = "libchanges";
+const QString KLibraryVersion   = "libraryversion";
+const QString KTrackDuration    = "trackduration";
+const QString KTrackPosition    = "trackposition";
+const QString KStats            = "stats";
+const QString KArtwork          = "artwork";
+const QString KArtworkChunk     = "artchunk";
+const QString KNoArtwork        = "no artwork";
+const QString KArtworkExpired   = "artwork expired";
+const QString KBadRange         = "offset out of range";
+const QString KBadPaging        = "cursor and count must be numbers";
+const QString KNoArguments      = "%1 takes no arguments";
+const QString KUnknownLocation  = "not a track in the library";
+const QString KBackendBusy      = "player is busy";
+const QString KClientThrottled  = "too many requests, slow down";
+const QString KBackendDegraded  = "player is not responding";
+const QString KBackendTimedOut  = "player command timed out";
+const QString KNotSupported     = "not supported by %1";
+const QString KResponseTemplate = "<response><status>%1</status><request>%2</request><text>%3</text></response>";
+
+const int KStatusSuccess =  200;
+const int KStatusBadRequest = 400;
+const int KStatusNotFound = 404;
+const int KStatusGone = 410;
+const int KStatusInternalError = 500;
+const int KStatusNotImplemented = 501;
+const int KStatusServiceUnavailable = 503;
+const int KStatusGatewayTimeout = 504;
+const int KOneSecondInMs = 1000;
+const int KSyncIntervalInMs = KOneSecondInMs*4;
+const quint16 KPort = 1500;
+const quint16 KWebPort = 1501;
+
+// watchdog limits, a per operation timeout can be given in the commands xml
+const int KDefaultCommandTimeoutInMs = KOneSecondInMs*3;
+const int KReapTimeoutInMs = 500;
+const int KHealthProbeIntervalInMs = KOneSecondInMs*2;
+const int KMaxProcessOutputInBytes = 4096;
+
+const int KDefaultPageSize = 50;
+
+// artwork is pulled in chunks so that control requests interleave with it
+const int KArtworkChunkInBytes = 8192;
+const int KDefaultArtworkSize = 120;
+const int KMinArtworkSize = 32;
+const int KMaxArtworkSize = 512;
+
+Server::Server(QWidget *parent)
+:   QDialog(parent), tcpServer(0), networkSession(0), mWebGateway(0),
+    mInternalSync(false), mCommandTimedOut(false), mBackendDegraded(false),
+    mHealthProbe(false)
+{
+    statusLabel = new QLabel;
+    quitButton = new QPushButton(tr("Quit"));
+    quitButton->setAutoDefault(false);
+    mCurrentTrackName.clear();
+    mProcess = new QProcess(this);
+    mCurrentRequest.clear();
+    connect(mProcess,SIGNAL(finished(int,QProcess::ExitStatus)),this,SLOT(processFinished(int,QProcess::ExitStatus)));
+    connect(mProcess,SIGNAL(error(QProcess::ProcessError)),this,SLOT(processError(QProcess::ProcessError)));
+    connect(mProcess,SIGNAL(readyReadStandardOutput()),this,SLOT(readProcessOutput()));
+
+    mWatchdog = new QTimer(this);
+    mWatchdog->setSingleShot(true);
+    connect(mWatchdog,SIGNAL(timeout()),this,SLOT(handleCommandTimeout()));
+
+// Populate command filename depending on the underlying platform
+    QString commandsFileName;
+#ifdef Q_OS_LINUX
+    commandsFileName = ":/xml/linux_commands.xml";
+#else Q_OS_WIN32
+    commandsFileName = ":/xml/win_commands.xml";
+#endif
+
+    mCommands = new QFile(commandsFileName,this);
+    if(!mCommands->open(QIODevice::ReadOnly))
+    {
+
+    }
+
+    mAdmission = new AdmissionControl(this);
+
+    mLibrary = new LibraryIndex(this);
+    connect(mLibrary,SIGNAL(versionChanged(int)),this,SLOT(libraryChanged(int)));
+    mArtwork = new ArtworkCache(this);
+    connect(mArtwork,SIGNAL(loaded(QString,bool)),this,SLOT(artworkLoaded(QString,bool)));
+
+    // The player is picked once here, requests are then routed without touching the xml.
+    // Clients are accepted only after that, see playerDetected()
+    statusLabel->setText(tr("Looking for a player..."));
+    mPlayerDetector = new PlayerDetector(this);
+    connect(mPlayerDetector,SIGNAL(detectionFinished()),this,SLOT(playerDetected()));
+    mPlayerDetector->detect(mCommands);
+
+    connect(quitButton, SIGNAL(clicked()), this, SLOT(close()));
+
+    QHBoxLayout *buttonLayout = new QHBoxLayout;
+    buttonLayout->addStretch(1);
+    buttonLayout->addWidget(quitButton);
+    buttonLayout->addStretch(1);
+
+    QVBoxLayout *mainLayout = new QVBoxLayout;
+    mainLayout->addWidget(statusLabel);
+    mainLayout->addLayout(buttonLayout);
+    setLayout(mainLayout);
+    setWindowTitle(tr("Angel Server"));
+}
+
+Server::~Server()
+{
+}
+
+void Server::openSession()
+{
+    tcpServer = new QTcpServer(this);
+    if (!tcpServer->listen(QHostAddress::Any,KPort)) {
+        QMessageBox::critical(this, tr("Angel Server"),
+                              tr("Unable to start the server: %1.")
+                              .arg(tcpServer->errorString()));
+        close();
+        return;
+    }
+    connect(tcpServer, SIGNAL(newConnection()), this, SLOT(handleNewConnection()));
+
+    // Browsers on the same network get the control page and a websocket here
+    mWebGateway = new WebGateway(this);
+    connect(mWebGateway,SIGNAL(sessionOpened(ClientSession*)),this,SLOT(openClientSession(ClientSession*)));
+    QString webPort = tr("not available");
+    if(mWebGateway->listen(KWebPort))
+    {
+        webPort = QString::number(mWebGateway->serverPort());
+    }
+    else
+    {
+        qDebug()<<"web gateway:"<<mWebGateway->errorString();
+    }
+
+    QString ipAddress;
+    QList<QHostAddress> ipAddressesList = QNetworkInterface::allAddresses();
+    // use the first non-localhost IPv4 address
+    for (int i = 0; i < ipAddressesList.size(); ++i) {
+        if (ipAddressesList.at(i) != QHostAddress::LocalHost &&
+            ipAddressesList.at(i).toIPv4Address()) {
+            ipAddress = ipAddressesList.at(i).toString();
+            break;
+        }
+    }
+    // if we did not find one, use IPv4 localhost
+    if (ipAddress.isEmpty())
+        ipAddress = QHostAddress(QHostAddress::LocalHost).toString();
+    statusLabel->setText(tr("The server is running on\n\nIP: %1\nport: %2\n\n"
+                            "Run the Angel Client now. \n"
+                            "In case of connection error, manually set IP and port and click connect in Angel Client\n\n"
+                            "Browsers can open http://%1:%3/")
+                         .arg(ipAddress).arg(tcpServer->serverPort()).arg(webPort));
+}
+
+void Server::handleNewConnection()
+{
+    while(tcpServer->hasPendingConnections())
+    {
+        openClientSession(new TcpSession(tcpServer->nextPendingConnection(),this));
+    }
+}
+
+void Server::openClientSession(ClientSession* aSession)
+{
+    // Native and browser sessions share everything from here on
+    aSession->setParent(this);
+    mSessions.append(aSession);
+    mAdmission->addSession(aSession);
+    connect(aSession,SIGNAL(requestReceived(QString)),this,SLOT(handleRequest(QString)));
+    connect(aSession,SIGNAL(closed()),this,SLOT(closeClientSession()));
+
+    QString response = "Conneted Successfully : "+mPlayerName;
+    if(mCommandForPlayer.isEmpty())
+    {
+        response = "No supporting player!";
+    }
+    sendResponse(aSession,KStatusSuccess,response,KConnect);
+
+    // start sync timer
+    if(!mSyncTimer.isActive())
+    {
+        mSyncTimer.start(KSyncIntervalInMs,this);
+    }
+}
+
+void Server::closeClientSession()
+{
+    ClientSession* session = static_cast<ClientSession*>(sender());
+    mSessions.removeAll(session);
+    mAdmission->removeSession(session);
+    if(mSessions.isEmpty())
+    {
+        mSyncTimer.stop();
+    }
+}
+
+void Server::handleRequest(QString aRequest)
+{
+    ClientSession* session = qobject_cast<ClientSession*>(sender());
+    if(session)
+    {
+        processRequest(session,aRequest);
+    }
+}
+
+void Server::processRequest(ClientSession* aSession, QString aRequest)
+{
+    qDebug()<<"requestFromClient: "<<aRequest;
+    QString operation = aRequest.section(' ',0,0);
+    QString arguments = aRequest.section(' ',1);
+
+    // Over its rate a session is answered right away, nothing is queued for it
+    if(!mAdmission->admit(aSession,operationClass(operation)))
+    {
+        sendResponse(aSession,KStatusServiceUnavailable,KClientThrottled,aRequest);
+        return;
+    }
+
+    if(KStats == operation)
+    {
+        sendResponse(aSession,KStatusSuccess,mAdmission->statistics().join("; "),aRequest);
+        return;
+    }
+
+    // Library and artwork requests are served by the server and never reach the player
+    if(KBrowse == operation || KSearch == operation || KLibraryChanges == operation)
+    {
+        handleLibraryRequest(aSession,aRequest,operation,arguments);
+        return;
+    }
+    if(KArtwork == operation || KArtworkChunk == operation)
+    {
+        handleArtworkRequest(aSession,aRequest,operation,arguments);
+        return;
+    }
+
+    if(!mActivePlayer.supports(operation))
+    {
+        sendResponse(aSession,KStatusNotImplemented,KNotSupported.arg(mPlayerName),aRequest);
+        return;
+    }
+
+    if(!arguments.isEmpty() && !mActivePlayer.acceptsArguments(operation))
+    {
+        sendResponse(aSession,KStatusBadRequest,KNoArguments.arg(operation),aRequest);
+        return;
+    }
+    // The player would read anything starting with '-' as an option, so the
+    // argument has to be a track the library knows
+    if(!arguments.isEmpty() && !mLibrary->contains(arguments))
+    {
+        sendResponse(aSession,KStatusBadRequest,KUnknownLocation,aRequest);
+        return;
+    }
+
+    // Fail fast instead of queueing behind a hung player
+    if(mBackendDegraded)
+    {
+        sendResponse(aSession,KStatusServiceUnavailable,KBackendDegraded,aRequest);
+        return;
+    }
+
+    // Refreshed by the sync or by a session that just asked, no need to run the player
+    if(arguments.isEmpty() && mTrackAnswers.contains(operation) && KSyncIntervalInMs > mTrackAnswersAge.elapsed())
+    {
+        sendResponse(aSession,KStatusSuccess,mTrackAnswers.value(operation),aRequest);
+        return;
+    }
+
+    // The player runs one command at a time, sessions take turns
+    if(!mAdmission->enqueue(aSession,aRequest))
+    {
+        sendResponse(aSession,KStatusServiceUnavailable,KBackendBusy,aRequest);
+        return;
+    }
+    dispatchCommand();
+}
+
+void Server::dispatchCommand()
+{
+    if(0 == mAdmission->queuedCount())
+    {
+        return;
+    }
+
+    ClientSession* session = 0;
+    QString request;
+    if(mBackendDegraded)
+    {
+        while(mAdmission->takeNext(session,request))
+        {
+            sendResponse(session,KStatusServiceUnavailable,KBackendDegraded,request);
+        }
+        return;
+    }
+
+    if(QProcess::NotRunning != mProcess->state())
+    {
+        if(!mInternalSync)
+        {
+            return; // dispatched again when the running command is done
+        }
+        // A client request wins over the background sync, drop its result
+        mWatchdog->stop();
+        mProcess->blockSignals(true);
+        mProcess->kill();
+        bool reaped = mProcess->waitForFinished(KReapTimeoutInMs);
+        mProcess->blockSignals(false);
+        if(!reaped)
+        {
+            // Still running: starting another command would fail and its late
+            // finish would answer the client with sync output. It stays the
+            // sync it was, and the player is treated as hung.
+            qDebug()<<"sync command did not die";
+            markBackendDegraded();
+            dispatchCommand();
+            return;
+        }
+        mInternalSync = false;
+    }
+
+    mAdmission->takeNext(session,request);
+    if(AdmissionControl::Control == operationClass(request.section(' ',0,0)))
+    {
+        // the track may change under it
+        mTrackAnswers.clear();
+    }
+    mCurrentSession = session;
+    mCurrentRequest = request;
+    executeCommand(request.section(' ',0,0),request.section(' ',1));
+}
+
+AdmissionControl::OperationClass Server::operationClass(QString aOperation)
+{
+    if(KArtwork == aOperation || KArtworkChunk == aOperation)
+    {
+        return AdmissionControl::ArtworkOperation;
+    }
+    if(KBrowse == aOperation || KSearch == aOperation || KLibraryChanges == aOperation || KStats == aOperation)
+    {
+        return AdmissionControl::ServerOperation;
+    }
+    if(KNowPlaying == aOperation || KTrackDuration == aOperation || KTrackPosition == aOperation)
+    {
+        return AdmissionControl::QueryOperation;
+    }
+    return AdmissionControl::ControlOperation;
+}
+
+void Server::handleLibraryRequest(ClientSession* aSession, QString aRequest, QString aOperation, QString aArguments)
+{
+    // browse [cursor] [count]
+    // search <cursor> <count> <prefix>
+    // libchanges <version>
+    QString response;
+    if(KBrowse == aOperation)
+    {
+        int cursor = aArguments.section(' ',0,0).toInt();
+        bool ok = false;
+        int count = aArguments.section(' ',1,1).toInt(&ok);
+        response = mLibrary->browse(cursor,(ok)?(count):(KDefaultPageSize));
+    }
+    else if(KSearch == aOperation)
+    {
+        // a missing cursor or count takes the browse defaults, garbage is refused
+        QString cursorText = aArguments.section(' ',0,0);
+        QString countText = aArguments.section(' ',1,1);
+        bool cursorOk = true;
+        bool countOk = true;
+        int cursor = (cursorText.isEmpty())?(0):(cursorText.toInt(&cursorOk));
+        int count = (countText.isEmpty())?(KDefaultPageSize):(countText.toInt(&countOk));
+        if(!cursorOk || !countOk)
+        {
+            sendResponse(aSession,KStatusBadRequest,KBadPaging,aRequest);
+            return;
+        }
+        response = mLibrary->search(aArguments.section(' ',2),cursor,count);
+    }
+    else
+    {
+        response = mLibrary->changes(aArguments.toInt());
+    }
+    sendResponse(aSession,KStatusSuccess,response,aRequest);
+}
+
+void Server::handleArtworkRequest(ClientSession* aSession, QString aRequest, QString aOperation, QString aArguments)
+{
+    // artwork [size]            -> "<hash> <bytes>"
+    // artchunk <hash> <offset>  -> "<offset> <base64 data>"
+    if(KArtworkChunk == aOperation)
+    {
+        const ArtworkThumbnail* thumbnail = mArtwork->findByHash(aArguments.section(' ',0,0).toLatin1());
+        int offset = aArguments.section(' ',1,1).toInt();
+        if(!thumbnail)
+        {
+            sendResponse(aSession,KStatusGone,KArtworkExpired,aRequest);
+        }
+        else if(0 > offset || thumbnail->data.size() < offset)
+        {
+            sendResponse(aSession,KStatusBadRequest,KBadRange,aRequest);
+        }
+        else
+        {
+            QByteArray chunk = thumbnail->data.mid(offset,KArtworkChunkInBytes);
+            sendResponse(aSession,KStatusSuccess,QString::number(offset)+' '+chunk.toBase64(),aRequest);
+        }
+        return;
+    }
+
+    int size = aArguments.toInt();
+    size = (0 < size)?(qBound(KMinArtworkSize,size,KMaxArtworkSize)):(KDefaultArtworkSize);
+    QString location;
+    if(!mCurrentTrackName.isEmpty())
+    {
+        location = mLibrary->locationOf(mCurrentTrackName);
+    }
+    if(location.isEmpty())
+    {
+        sendResponse(aSession,KStatusNotFound,KNoArtwork,aRequest);
+        return;
+    }
+
+    QString key = ArtworkCache::key(location,size);
+    const ArtworkThumbnail* thumbnail = mArtwork->find(key);
+    if(thumbnail)
+    {
+        sendResponse(aSession,KStatusSuccess,thumbnail->hash+' '+QString::number(thumbnail->data.size()),aRequest);
+        return;
+    }
+
+    // Only local files have a folder to look in, an empty path would mean our working directory
+    QString file = QUrl::fromEncoded(location.toUtf8()).toLocalFile();
+    QString cover;
+    if(!file.isEmpty())
+    {
+        cover = ArtworkCache::coverInFolder(QFileInfo(file).absolutePath());
+    }
+    if(cover.isEmpty())
+    {
+        sendResponse(aSession,KStatusNotFound,KNoArtwork,aRequest);
+        return;
+    }
+    // answered from artworkLoaded() once the worker has scaled it
+    mPendingArtwork.insert(key,qMakePair(QPointer<ClientSession>(aSession),aRequest));
+    mArtwork->load(key,cover,size);
+}
+
+void Server::artworkLoaded(QString aKey, bool aSucceeded)
+{
+    const ArtworkThumbnail* thumbnail = mArtwork->find(aKey);
+    typedef QPair<QPointer<ClientSession>,QString> PendingRequest;
+    foreach(const PendingRequest& pending, mPendingArtwork.values(aKey))
+    {
+        if(aSucceeded && thumbnail)
+        {
+            sendResponse(pending.first,KStatusSuccess,thumbnail->hash+' '+QString::number(thumbnail->data.size()),pending.second);
+        }
+        else
+        {
+            sendResponse(pending.first,KStatusNotFound,KNoArtwork,pending.second);
+        }
+    }
+    mPendingArtwork.remove(aKey);
+}
+
+void Server::libraryChanged(int aVersion)
+{
+    // Clients pull the delta with libchanges
+    broadcast(KStatusSuccess,QString::number(aVersion),KLibraryVersion);
+}
+
+void Server::executeCommand(QString aOperation, QString aArguments)
+{
+    // Options come from the commands xml, client text only ever travels as one
+    // argument of its own and is never parsed as a command line
+    QString program = mCommandForPlayer.simplified();
+    QStringList arguments = option(aOperation).split(' ',QString::SkipEmptyParts);
+    if(!aArguments.isEmpty())
+    {
+        arguments.append(aArguments);
+    }
+    qDebug()<<"commandToExecute:"<<program<<arguments;
+    mProcessOutput.clear();
+    mCommandTimedOut = false;
+    mProcess->start(program,arguments);
+    mWatchdog->start(commandTimeout(aOperation));
+}
+
+void Server::handleCommandTimeout()
+{
+    qDebug()<<__FUNCTION__<<mProcess->pid();
+    if(QProcess::NotRunning == mProcess->state())
+    {
+        return;
+    }
+    mCommandTimedOut = true;
+    mProcess->kill();
+    // reap it right away so that the next command finds the process free
+    mProcess->waitForFinished(KReapTimeoutInMs);
+}
+
+void Server::processError(QProcess::ProcessError aError)
+{
+    qDebug()<<__FUNCTION__<<aError;
+    // Only a failed start never reaches processFinished()
+    if(QProcess::FailedToStart != aError)
+    {
+        return;
+    }
+    mWatchdog->stop();
+    QMetaObject::invokeMethod(this,"dispatchCommand",Qt::QueuedConnection);
+    if(mHealthProbe || mInternalSync)
+    {
+        mHealthProbe = false;
+        mInternalSync = false;
+        return;
+    }
+    sendResponse(KStatusInternalError,mProcess->errorString());
+}
+
+void Server::processFinished (int exitCode,QProcess::ExitStatus exitStatus)
+{
+qDebug()<<__FUNCTION__;
+    mWatchdog->stop();
+    // the next waiting command starts once this one is answered
+    QMetaObject::invokeMethod(this,"dispatchCommand",Qt::QueuedConnection);
+    readProcessOutput();
+    QString response = QString::fromLocal8Bit(mProcessOutput).simplified();
+    mProcessOutput.clear();
+
+    if(mCommandTimedOut)
+    {
+        mCommandTimedOut = false;
+        markBackendDegraded();
+        if(!mInternalSync && !mHealthProbe)
+        {
+            sendResponse(KStatusGatewayTimeout,KBackendTimedOut);
+        }
+        mInternalSync = false;
+        mHealthProbe = false;
+        return;
+    }
+
+    if(mHealthProbe)
+    {
+        mHealthProbe = false;
+        if(0 == exitCode && QProcess::NormalExit == exitStatus)
+        {
+            qDebug()<<"player is responding again";
+            mBackendDegraded = false;
+            mHealthProbeTimer.stop();
+        }
+        return;
+    }
+
+    // check if sycn is required
+    if(mInternalSync)
+    {
+        mInternalSync = false;
+        qDebug()<<"sync required: "<<mCurrentTrackName<<" "<<response;
+        if(0 == exitCode)
+        {
+            rememberTrackAnswer(KNowPlaying,response);
+        }
+        if(mCurrentTrackName != response)
+        {
+        mCurrentTrackName = response;
+        sync();
+        }
+
+    }
+
+    else
+    {
+    int stat = (0 == exitCode)?(KStatusSuccess):(KStatusInternalError);
+    if(KStatusSuccess == stat && KNowPlaying == mCurrentRequest)
+    {
+        mCurrentTrackName = response;
+    }
+    if(KStatusSuccess == stat && (KNowPlaying == mCurrentRequest || KTrackDuration == mCurrentRequest))
+    {
+        rememberTrackAnswer(mCurrentRequest,response);
+    }
+    sendResponse(stat,response);
+    }
+}
+
+void Server::readProcessOutput()
+{
+    // Keep only the head of the output, a runaway player must not eat memory
+    QByteArray chunk = mProcess->readAllStandardOutput();
+    int room = KMaxProcessOutputInBytes - mProcessOutput.size();
+    if(room > 0)
+    {
+        mProcessOutput.append(chunk.left(room));
+    }
+}
+
+void Server::timerEvent(QTimerEvent *event)
+{
+    if(event->timerId() == mHealthProbeTimer.timerId())
+    {
+        probeBackendHealth();
+    }
+    else if(event->timerId() == mSyncTimer.timerId())
+    {
+        checkIsSyncRequired();
+    }
+}
+
+void Server::checkIsSyncRequired()
+{
+    if(mBackendDegraded || QProcess::NotRunning != mProcess->state() || 0 < mAdmission->queuedCount())
+    {
+        return;
+    }
+    mInternalSync = true;
+    executeCommand(KNowPlaying); // check for track title
+}
+
+void Server::rememberTrackAnswer(QString aOperation, QString aResponse)
+{
+    // a new title makes the other answers stale
+    if(KNowPlaying == aOperation && aResponse != mTrackAnswers.value(KNowPlaying))
+    {
+        mTrackAnswers.clear();
+    }
+    mTrackAnswers.insert(aOperation,aResponse);
+    mTrackAnswersAge.restart();
+}
+
+void Server::markBackendDegraded()
+{
+    qDebug()<<__FUNCTION__;
+    mBackendDegraded = true;
+    mTrackAnswers.clear();
+    if(!mHealthProbeTimer.isActive())
+    {
+        mHealthProbeTimer.start(KHealthProbeIntervalInMs,this);
+    }
+}
+
+void Server::probeBackendHealth()
+{
+    if(QProcess::NotRunning != mProcess->state())
+    {
+        return;
+    }
+    mHealthProbe = true;
+    executeCommand(KNowPlaying);
+}
+
+void Server::sync()
+{
+    // pushed to every session, browsers included
+    broadcast(KStatusSuccess,KSyncNow,KSyncNow);
+}
+
+void Server::playerDetected()
+{
+    const PlayerInfo* player = mPlayerDetector->activePlayer();
+    if(player)
+    {
+        mActivePlayer = *player;
+        mPlayerName = mActivePlayer.name;
+        mCommandForPlayer = commandForPlayer(mPlayerName);
+        qDebug()<<__FUNCTION__<<mPlayerName<<mActivePlayer.options.keys();
+    }
+    // Listen only now, so nobody is greeted before we know which player we drive
+    if(!tcpServer)
+    {
+        openSession();
+    }
+    if(!player)
+    {
+        qDebug()<<"no supporting player found";
+        return;
+    }
+
+    QString database = mActivePlayer.library;
+    if(database.startsWith("~/"))
+    {
+        database.replace(0,1,QDir::homePath());
+    }
+    mLibrary->setSources(database,QDesktopServices::storageLocation(QDesktopServices::MusicLocation));
+}
+
+QString Server::commandForPlayer(QString aPlayerName)
+{
+    const PlayerInfo* player = mPlayerDetector->player(aPlayerName);
+    return (player)?(player->command):(QString());
+}
+
+QString Server::option(QString aId)
+{
+    return mActivePlayer.options.value(aId);
+}
+
+int Server::commandTimeout(QString aId)
+{
+    return mActivePlayer.timeouts.value(aId,KDefaultCommandTimeoutInMs);
+}
+
+QString Server::responseFrame(int aStatus, QString aRequest, QString aResponseText)
+{
+    // single pass over the template, percent encoded text must not be taken for markers
+    return KResponseTemplate.arg(QString::number(aStatus),aRequest,aResponseText);
+}
+
+void Server::sendResponse(int aStatus, QString aResponseText)
+{
+    sendResponse(mCurrentSession,aStatus,aResponseText,mCurrentRequest);
+}
+
+void Server::sendResponse(ClientSession* aSession, int aStatus, QString aResponseText, QString aRequest)
+{
+    qDebug()<<__FUNCTION__;
+    if(!aSession)
+    {
+        return;
+    }
+    QString resp = responseFrame(aStatus,aRequest,aResponseText);
+    qDebug()<<resp;
+    aSession->send(resp);
+}
+
+void Server::broadcast(int aStatus, QString aResponseText, QString aRequest)
+{
+    QString resp = responseFrame(aStatus,aRequest,aResponseText);
+    foreach(ClientSession* session, mSessions)
+    {
+        session->send(resp);
+    }
+}
+
+//eof
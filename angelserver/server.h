@@ -1,103 +1,155 @@
-/****************************************************************************
-**
-** Copyright (C) 2010 Nokia Corporation and/or its subsidiary(-ies).
-** All rights reserved.
-** Contact: Nokia Corporation (qt-info@nokia.com)
-**
-** This file is part of the examples of the Qt Toolkit.
-**
-** $QT_BEGIN_LICENSE:BSD$
-** You may use this file under the terms of the BSD license as follows:
-**
-** "Redistribution and use in source and binary forms, with or without
-** modification, are permitted provided that the following conditions are
-** met:
-**   * Redistributions of source code must retain the above copyright
-**     notice, this list of conditions and the following disclaimer.
-**   * Redistributions in binary form must reproduce the above copyright
-**     notice, this list of conditions and the following disclaimer in
-**     the documentation and/or other materials provided with the
-**     distribution.
-**   * Neither the name of Nokia Corporation and its Subsidiary(-ies) nor
-**     the names of its contributors may be used to endorse or promote
-**     products derived from this software without specific prior written
-**     permission.
-**
-** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
-** "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
-** LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
-** A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
-** OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
-** SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
-** LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
-** DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
-** THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
-** (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
-** OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE."
-** $QT_END_LICENSE$
-**
-****************************************************************************/
-
-#ifndef SERVER_H
-#define SERVER_H
-
-#include <QDialog>
-#include <QProcess>
-
-QT_BEGIN_NAMESPACE
-class QLabel;
-class QPushButton;
-class QTcpServer;
-class QNetworkSession;
-QT_END_NAMESPACE
-
-//! [0]
-class QTcpSocket;
-class QProcess;
-class QXmlQuery;
-class QFile;
-class Server : public QDialog
-{
-    Q_OBJECT
-
-public:
-    Server(QWidget *parent = 0);
-    ~Server();
-
-private slots:
-    void openSession();
-    void handleNewConnection();
-
-    void handleRequest();
-    QString commandForPlayer(QString aPlayerName);
-    QString option(QString aId);
-    void sendResponse(int aStatus, QString aResponseText);
-
-    void readProcessOutput();
-    void processFinished (int exitCode,QProcess::ExitStatus exitStatus);
-private:
-    void executeCommand(QString aRequest);
-    void timerEvent(QTimerEvent *event);
-    void checkIsSyncRequired();
-    void sync();
-
-private:
-    QLabel *statusLabel;
-    QPushButton *quitButton;
-    QTcpServer *tcpServer;
-    QStringList fortunes;
-    QNetworkSession *networkSession;
-    QTcpSocket *mClientConnection;
-    QProcess *mProcess;
-    QXmlQuery* mXmlQuery;
-    bool mIsLastRequestSuccess;
-    QString mCommandForPlayer;
-    QString mPlayerName;
-    QFile* mCommands;
-    QString mCurrentTrackName;
-    QString mCurrentRequest;
-    bool mInternalSync;
-};
-//! [0]
-
-#endif
+/****************************************************************************
+**
+** Copyright (C) 2010 Nokia Corporation and/or its subsidiary(-ies).
+** All rights reserved.
+** Contact: Nokia Corporation (qt-info@nokia.com)
+**
+** This file is part of the examples of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:BSD$
+** You may use this file under the terms of the BSD license as follows:
+**
+** "Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are
+** met:
+**   * Redistributions of source code must retain the above copyright
+**     notice, this list of conditions and the following disclaimer.
+**   * Redistributions in binary form must reproduce the above copyright
+**     notice, this list of conditions and the following disclaimer in
+**     the documentation and/or other materials provided with the
+**     distribution.
+**   * Neither the name of Nokia Corporation and its Subsidiary(-ies) nor
+**     the names of its contributors may be used to endorse or promote
+**     products derived from this software without specific prior written
+**     permission.
+**
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+** "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+** LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+** A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+** OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+** SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+** LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+** DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+** THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+** (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+** OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE."
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <QDialog>
+#include <QProcess>
+#include <QBasicTimer>
+#include <QPointer>
+#include <QPair>
+#include <QHash>
+#include <QElapsedTimer>
+#include "playerdetector.h"
+#include "libraryindex.h"
+#include "artworkcache.h"
+#include "clientsession.h"
+#include "webgateway.h"
+#include "admissioncontrol.h"
+
+QT_BEGIN_NAMESPACE
+class QLabel;
+class QPushButton;
+class QTcpServer;
+class QNetworkSession;
+class QTimer;
+QT_END_NAMESPACE
+
+//! [0]
+class QProcess;
+class QFile;
+class Server : public QDialog
+{
+    Q_OBJECT
+
+public:
+    Server(QWidget *parent = 0);
+    ~Server();
+
+    // One <response> frame as it goes on the wire
+    static QString responseFrame(int aStatus, QString aRequest, QString aResponseText);
+
+private slots:
+    void openSession();
+    void handleNewConnection();
+    void openClientSession(ClientSession* aSession);
+    void closeClientSession();
+
+    void handleRequest(QString aRequest);
+    void playerDetected();
+    void libraryChanged(int aVersion);
+    void artworkLoaded(QString aKey, bool aSucceeded);
+    QString commandForPlayer(QString aPlayerName);
+    QString option(QString aId);
+    int commandTimeout(QString aId);
+    void sendResponse(int aStatus, QString aResponseText);
+
+    void readProcessOutput();
+    void processFinished (int exitCode,QProcess::ExitStatus exitStatus);
+    void processError(QProcess::ProcessError aError);
+    void handleCommandTimeout();
+    void dispatchCommand();
+private:
+    void sendResponse(ClientSession* aSession, int aStatus, QString aResponseText, QString aRequest);
+    void broadcast(int aStatus, QString aResponseText, QString aRequest);
+    void executeCommand(QString aOperation, QString aArguments = QString());
+    void processRequest(ClientSession* aSession, QString aRequest);
+    AdmissionControl::OperationClass operationClass(QString aOperation);
+    void handleLibraryRequest(ClientSession* aSession, QString aRequest, QString aOperation, QString aArguments);
+    void handleArtworkRequest(ClientSession* aSession, QString aRequest, QString aOperation, QString aArguments);
+    void timerEvent(QTimerEvent *event);
+    void checkIsSyncRequired();
+    void sync();
+    void rememberTrackAnswer(QString aOperation, QString aResponse);
+    void markBackendDegraded();
+    void probeBackendHealth();
+
+private:
+    QLabel *statusLabel;
+    QPushButton *quitButton;
+    QTcpServer *tcpServer;
+    QStringList fortunes;
+    QNetworkSession *networkSession;
+    WebGateway* mWebGateway;
+    QList<ClientSession*> mSessions;
+    AdmissionControl* mAdmission;
+    QPointer<ClientSession> mCurrentSession;   // session waiting for the running player command
+    QProcess *mProcess;
+    PlayerDetector* mPlayerDetector;
+    PlayerInfo mActivePlayer;
+    LibraryIndex* mLibrary;
+    ArtworkCache* mArtwork;
+    QMultiHash<QString,QPair<QPointer<ClientSession>,QString> > mPendingArtwork;   // artwork key -> requests waiting for it
+    bool mIsLastRequestSuccess;
+    QString mCommandForPlayer;
+    QString mPlayerName;
+    QFile* mCommands;
+    QString mCurrentTrackName;
+    QString mCurrentRequest;
+    bool mInternalSync;
+
+    // nowplaying and trackduration answers for the current track, a syncnow
+    // push is answered from here instead of one player command per session
+    QHash<QString,QString> mTrackAnswers;
+    QElapsedTimer mTrackAnswersAge;
+
+    // watchdog for the player command currently executing
+    QTimer* mWatchdog;
+    QByteArray mProcessOutput;
+    bool mCommandTimedOut;
+    bool mBackendDegraded;
+    bool mHealthProbe;
+    QBasicTimer mHealthProbeTimer;
+    QBasicTimer mSyncTimer;
+};
+//! [0]
+
+#endif
@@ -0,0 +1,223 @@
+#!/usr/bin/env python3
+"""Scripted websocket client for checking the web gateway of a running server.
+
+    python3 wsclient.py [--host localhost] [--port 1501] [--skip-push]
+
+Steps, each reported as PASS or FAIL:
+  handshake   upgrade /ws, check Sec-WebSocket-Accept and permessage-deflate
+  round trip  send "stats", expect a 200 <response> for it
+  deflate     send a compressed request, expect a compressed response to it
+  push        a second session sends "next", the first one has to be pushed
+              "syncnow" once the server notices the new track (needs a
+              player with a playlist, --skip-push leaves it out)
+
+Only the python standard library is used. Exit status is 0 when all steps pass.
+"""
+
+import argparse
+import base64
+import hashlib
+import os
+import re
+import socket
+import struct
+import sys
+import zlib
+
+GUID = b"258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+DEFLATE_TAIL = b"\x00\x00\xff\xff"
+TEXT_FRAME = 0x1
+CLOSE_FRAME = 0x8
+PUSH_TIMEOUT = 12.0     # next -> player -> sync timer (4 s) -> syncnow
+
+
+class Session:
+    def __init__(self, host, port):
+        self.sock = socket.create_connection((host, port), timeout=5.0)
+        self.buffer = b""
+        self.deflate = False
+
+    def handshake(self):
+        key = base64.b64encode(os.urandom(16))
+        self.sock.sendall(b"GET /ws HTTP/1.1\r\n"
+                          b"Host: angel\r\n"
+                          b"Upgrade: websocket\r\n"
+                          b"Connection: Upgrade\r\n"
+                          b"Sec-WebSocket-Key: " + key + b"\r\n"
+                          b"Sec-WebSocket-Version: 13\r\n"
+                          b"Sec-WebSocket-Extensions: permessage-deflate; client_no_context_takeover\r\n"
+                          b"\r\n")
+        while b"\r\n\r\n" not in self.buffer:
+            self.fill()
+        head, self.buffer = self.buffer.split(b"\r\n\r\n", 1)
+        lines = head.split(b"\r\n")
+        if b" 101 " not in lines[0]:
+            raise AssertionError("no upgrade: %r" % lines[0])
+        headers = {}
+        for line in lines[1:]:
+            name, _, value = line.partition(b":")
+            headers[name.strip().lower()] = value.strip()
+        expected = base64.b64encode(hashlib.sha1(key + GUID).digest())
+        if headers.get(b"sec-websocket-accept") != expected:
+            raise AssertionError("bad Sec-WebSocket-Accept")
+        self.deflate = b"permessage-deflate" in headers.get(b"sec-websocket-extensions", b"")
+        if not self.deflate:
+            raise AssertionError("permessage-deflate was not negotiated")
+
+    def fill(self):
+        data = self.sock.recv(65536)
+        if not data:
+            raise AssertionError("connection closed by the server")
+        self.buffer += data
+
+    def send(self, text, compressed=False):
+        payload = text.encode("utf-8")
+        first = 0x80 | TEXT_FRAME
+        if compressed:
+            deflater = zlib.compressobj(zlib.Z_DEFAULT_COMPRESSION, zlib.DEFLATED, -zlib.MAX_WBITS)
+            payload = deflater.compress(payload) + deflater.flush(zlib.Z_SYNC_FLUSH)
+            if payload.endswith(DEFLATE_TAIL):
+                payload = payload[:-len(DEFLATE_TAIL)]
+            first |= 0x40
+        # clients must mask every frame
+        mask = os.urandom(4)
+        masked = bytes(byte ^ mask[i % 4] for i, byte in enumerate(payload))
+        length = len(payload)
+        if length < 126:
+            header = struct.pack("!BB", first, 0x80 | length)
+        elif length <= 0xffff:
+            header = struct.pack("!BBH", first, 0x80 | 126, length)
+        else:
+            header = struct.pack("!BBQ", first, 0x80 | 127, length)
+        self.sock.sendall(header + mask + masked)
+
+    def receive(self, timeout=5.0):
+        """Next text message as (text, was_compressed)."""
+        self.sock.settimeout(timeout)
+        while True:
+            while len(self.buffer) < 2:
+                self.fill()
+            first, second = self.buffer[0], self.buffer[1]
+            if second & 0x80:
+                raise AssertionError("server frames must not be masked")
+            length = second & 0x7f
+            offset = 2
+            if length == 126:
+                offset = 4
+            elif length == 127:
+                offset = 10
+            while len(self.buffer) < offset:
+                self.fill()
+            if length == 126:
+                length = struct.unpack("!H", self.buffer[2:4])[0]
+            elif length == 127:
+                length = struct.unpack("!Q", self.buffer[2:10])[0]
+            while len(self.buffer) < offset + length:
+                self.fill()
+            payload = self.buffer[offset:offset + length]
+            self.buffer = self.buffer[offset + length:]
+            opcode = first & 0x0f
+            if opcode == CLOSE_FRAME:
+                raise AssertionError("server closed the websocket")
+            if opcode != TEXT_FRAME:
+                continue
+            compressed = bool(first & 0x40)
+            if compressed:
+                payload = zlib.decompressobj(-zlib.MAX_WBITS).decompress(payload + DEFLATE_TAIL)
+            return payload.decode("utf-8"), compressed
+
+    def response(self, request, timeout=5.0):
+        """Waits for the <response> to request, skipping pushes in between."""
+        while True:
+            text, compressed = self.receive(timeout)
+            fields = parse(text)
+            if fields["request"] == request:
+                return fields, compressed
+
+    def close(self):
+        self.sock.close()
+
+
+def parse(frame):
+    fields = {}
+    for name in ("status", "request", "text"):
+        match = re.search(r"<%s>(.*?)</%s>" % (name, name), frame, re.S)
+        if not match:
+            raise AssertionError("not a response frame: %r" % frame[:200])
+        fields[name] = match.group(1)
+    return fields
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Checks the websocket gateway of a running angelserver")
+    parser.add_argument("--host", default="localhost")
+    parser.add_argument("--port", type=int, default=1501)
+    parser.add_argument("--skip-push", action="store_true", help="leave out the step that needs a playing player")
+    options = parser.parse_args()
+
+    failures = []
+    sessions = []
+
+    def step(name, check):
+        try:
+            detail = check()
+            print("PASS %-10s %s" % (name, detail or ""))
+            return True
+        except (AssertionError, OSError, zlib.error) as error:
+            print("FAIL %-10s %s" % (name, error))
+            failures.append(name)
+            return False
+
+    def handshake():
+        session = Session(options.host, options.port)
+        sessions.append(session)
+        session.handshake()
+        fields, _ = session.response("connect")
+        return fields["text"]
+
+    def round_trip():
+        session = sessions[0]
+        session.send("stats")
+        fields, _ = session.response("stats")
+        if fields["status"] != "200":
+            raise AssertionError("status %s: %s" % (fields["status"], fields["text"]))
+        return fields["text"]
+
+    def deflate():
+        # the response echoes the request, so a long one comes back deflated
+        session = sessions[0]
+        request = "search 0 1 " + "deflate" * 64
+        session.send(request, compressed=True)
+        fields, compressed = session.response(request)
+        if fields["status"] != "200":
+            raise AssertionError("status %s: %s" % (fields["status"], fields["text"]))
+        if not compressed:
+            raise AssertionError("response was not compressed")
+        return "request and response compressed"
+
+    def push():
+        listener = sessions[0]
+        controller = Session(options.host, options.port)
+        sessions.append(controller)
+        controller.handshake()
+        controller.response("connect")
+        controller.send("next")
+        fields, _ = controller.response("next")
+        if fields["status"] != "200":
+            raise AssertionError("next: status %s: %s" % (fields["status"], fields["text"]))
+        fields, _ = listener.response("syncnow", PUSH_TIMEOUT)
+        return "syncnow pushed to the other session"
+
+    if step("handshake", handshake):
+        step("round trip", round_trip)
+        step("deflate", deflate)
+        if not options.skip_push:
+            step("push", push)
+
+    for session in sessions:
+        session.close()
+    return 1 if failures else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
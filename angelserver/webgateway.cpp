@@ -0,0 +1,439 @@
+#include <QtNetwork>
+#include <QDebug>
+#include "webgateway.h"
+#ifdef WEBSOCKET_DEFLATE
+#include <zlib.h>
+#endif
+
+const QByteArray KWebSocketGuid     = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+const QByteArray KHeadEnd           = "\r\n\r\n";
+const QByteArray KDeflateTail       = QByteArray("\x00\x00\xff\xff",4);
+const QByteArray KWebSocketPath     = "/ws";
+const QByteArray KPagePath          = "/";
+const QByteArray KIndexPath         = "/index.html";
+const QByteArray KPermessageDeflate = "permessage-deflate";
+const QString KControlPage          = ":/web/index.html";
+
+const int KMaxHeadInBytes = 8192;
+const int KMaxMessageInBytes = 65536;
+const int KMinDeflateInBytes = 256;   // smaller frames are not worth deflating
+const int KDeflateChunkInBytes = 4096;
+#ifdef WEBSOCKET_DEFLATE
+const bool KDeflateSupported = true;
+#else
+const bool KDeflateSupported = false;
+#endif
+
+// websocket opcodes
+const int KContinuationFrame = 0x0;
+const int KTextFrame = 0x1;
+const int KCloseFrame = 0x8;
+const int KPingFrame = 0x9;
+const int KPongFrame = 0xA;
+
+WebSocketSession::WebSocketSession(QTcpSocket* aSocket, bool aDeflate, QObject *parent)
+:   ClientSession(parent), mSocket(aSocket), mMessageCompressed(false),
+    mDeflate(aDeflate && KDeflateSupported), mDeflater(0), mInflater(0)
+{
+#ifdef WEBSOCKET_DEFLATE
+    if(mDeflate)
+    {
+        // raw deflate streams, no zlib header, as permessage-deflate wants
+        mDeflater = new z_stream;
+        mInflater = new z_stream;
+        memset(mDeflater,0,sizeof(z_stream));
+        memset(mInflater,0,sizeof(z_stream));
+        deflateInit2(mDeflater,Z_DEFAULT_COMPRESSION,Z_DEFLATED,-MAX_WBITS,8,Z_DEFAULT_STRATEGY);
+        inflateInit2(mInflater,-MAX_WBITS);
+    }
+#endif
+
+    mSocket->setParent(this);
+    connect(mSocket,SIGNAL(readyRead()),this,SLOT(readFrames()));
+    connect(mSocket,SIGNAL(disconnected()),this,SLOT(handleDisconnected()));
+}
+
+WebSocketSession::~WebSocketSession()
+{
+#ifdef WEBSOCKET_DEFLATE
+    if(mDeflater)
+    {
+        deflateEnd(mDeflater);
+        inflateEnd(mInflater);
+        delete mDeflater;
+        delete mInflater;
+    }
+#endif
+}
+
+void WebSocketSession::send(const QString& aFrame)
+{
+    QByteArray message = aFrame.toUtf8();
+    QByteArray compressed;
+    if(mDeflate && KMinDeflateInBytes <= message.size() && deflateMessage(message,compressed))
+    {
+        writeFrame(KTextFrame,compressed,true);
+        return;
+    }
+    writeFrame(KTextFrame,message);
+}
+
+QString WebSocketSession::peerName() const
+{
+    return "ws "+mSocket->peerAddress().toString()+':'+QString::number(mSocket->peerPort());
+}
+
+void WebSocketSession::readFrames()
+{
+    mBuffer.append(mSocket->readAll());
+    forever
+    {
+        if(2 > mBuffer.size())
+        {
+            return;
+        }
+        uchar first = mBuffer.at(0);
+        uchar second = mBuffer.at(1);
+        bool isFinal = first & 0x80;
+        bool compressed = first & 0x40;
+        int opcode = first & 0x0f;
+        quint64 length = second & 0x7f;
+        int headerSize = 2;
+        if(126 == length)
+        {
+            headerSize = 4;
+        }
+        else if(127 == length)
+        {
+            headerSize = 10;
+        }
+        if(mBuffer.size() < headerSize)
+        {
+            return;
+        }
+        if(2 < headerSize)
+        {
+            length = 0;
+            for(int i = 2; i < headerSize; ++i)
+            {
+                length = (length<<8) | uchar(mBuffer.at(i));
+            }
+        }
+
+        // browsers always mask, anything else is not a websocket client. The
+        // length is checked on its own first, a 64 bit length must not wrap the sum.
+        if(!(second & 0x80) || quint64(KMaxMessageInBytes) < length ||
+           KMaxMessageInBytes < int(length)+mMessage.size())
+        {
+            qDebug()<<"dropping websocket"<<peerName();
+            writeFrame(KCloseFrame,QByteArray());
+            mSocket->disconnectFromHost();
+            mBuffer.clear();
+            return;
+        }
+        int frameSize = headerSize+4+int(length);
+        if(0 > frameSize || mBuffer.size() < frameSize)
+        {
+            return;
+        }
+        QByteArray mask = mBuffer.mid(headerSize,4);
+        QByteArray payload = mBuffer.mid(headerSize+4,int(length));
+        mBuffer.remove(0,frameSize);
+        for(int i = 0; i < payload.size(); ++i)
+        {
+            payload[i] = payload.at(i) ^ mask.at(i%4);
+        }
+
+        switch(opcode)
+        {
+        case KTextFrame:
+            mMessage = payload;
+            mMessageCompressed = compressed;
+            break;
+        case KContinuationFrame:
+            mMessage.append(payload);
+            break;
+        case KPingFrame:
+            writeFrame(KPongFrame,payload);
+            continue;
+        case KCloseFrame:
+            writeFrame(KCloseFrame,payload.left(2));
+            mSocket->disconnectFromHost();
+            return;
+        default:
+            continue;   // binary and pong frames are not used
+        }
+
+        if(!isFinal)
+        {
+            continue;
+        }
+        QByteArray message = mMessage;
+        mMessage.clear();
+        if(mMessageCompressed)
+        {
+            QByteArray deflated = message;
+            if(!inflateMessage(deflated,message))
+            {
+                qDebug()<<"cannot inflate websocket message";
+                continue;
+            }
+        }
+        handleMessage(message);
+    }
+}
+
+void WebSocketSession::handleMessage(const QByteArray& aMessage)
+{
+    QString request = QString::fromUtf8(aMessage).simplified();
+    if(!request.isEmpty())
+    {
+        emit requestReceived(request);
+    }
+}
+
+void WebSocketSession::handleDisconnected()
+{
+    emit closed();
+    deleteLater();
+}
+
+void WebSocketSession::writeFrame(int aOpcode, const QByteArray& aPayload, bool aCompressed)
+{
+    QByteArray frame;
+    frame.append(char(0x80 | ((aCompressed)?(0x40):(0)) | aOpcode));
+    int length = aPayload.size();
+    if(126 > length)
+    {
+        frame.append(char(length));
+    }
+    else if(0xffff >= length)
+    {
+        frame.append(char(126));
+        frame.append(char(length>>8));
+        frame.append(char(length));
+    }
+    else
+    {
+        frame.append(char(127));
+        for(int shift = 56; shift >= 0; shift -= 8)
+        {
+            frame.append(char(quint64(length)>>shift));
+        }
+    }
+    frame.append(aPayload);
+    mSocket->write(frame);
+}
+
+bool WebSocketSession::deflateMessage(const QByteArray& aMessage, QByteArray& aCompressed)
+{
+#ifdef WEBSOCKET_DEFLATE
+    if(!mDeflater)
+    {
+        return false;
+    }
+    // every message is a stream of its own (server_no_context_takeover)
+    deflateReset(mDeflater);
+    mDeflater->next_in = reinterpret_cast<Bytef*>(const_cast<char*>(aMessage.constData()));
+    mDeflater->avail_in = aMessage.size();
+    char chunk[KDeflateChunkInBytes];
+    do
+    {
+        mDeflater->next_out = reinterpret_cast<Bytef*>(chunk);
+        mDeflater->avail_out = sizeof(chunk);
+        if(Z_STREAM_ERROR == deflate(mDeflater,Z_SYNC_FLUSH))
+        {
+            return false;
+        }
+        aCompressed.append(chunk,sizeof(chunk)-mDeflater->avail_out);
+    } while(0 == mDeflater->avail_out);
+
+    // the receiver puts the sync flush marker back
+    if(aCompressed.endsWith(KDeflateTail))
+    {
+        aCompressed.chop(KDeflateTail.size());
+    }
+    return aCompressed.size() < aMessage.size();
+#else
+    Q_UNUSED(aMessage);
+    Q_UNUSED(aCompressed);
+    return false;
+#endif
+}
+
+bool WebSocketSession::inflateMessage(const QByteArray& aCompressed, QByteArray& aMessage)
+{
+#ifdef WEBSOCKET_DEFLATE
+    if(!mInflater)
+    {
+        return false;
+    }
+    // we asked for client_no_context_takeover, so each message starts afresh
+    inflateReset(mInflater);
+    QByteArray input = aCompressed+KDeflateTail;
+    mInflater->next_in = reinterpret_cast<Bytef*>(input.data());
+    mInflater->avail_in = input.size();
+    aMessage.clear();
+    char chunk[KDeflateChunkInBytes];
+    do
+    {
+        mInflater->next_out = reinterpret_cast<Bytef*>(chunk);
+        mInflater->avail_out = sizeof(chunk);
+        int result = inflate(mInflater,Z_SYNC_FLUSH);
+        if(Z_OK != result && Z_STREAM_END != result && Z_BUF_ERROR != result)
+        {
+            return false;
+        }
+        aMessage.append(chunk,sizeof(chunk)-mInflater->avail_out);
+        if(KMaxMessageInBytes < aMessage.size())
+        {
+            return false;
+        }
+    } while(0 == mInflater->avail_out);
+    return true;
+#else
+    Q_UNUSED(aCompressed);
+    Q_UNUSED(aMessage);
+    return false;
+#endif
+}
+
+WebGateway::WebGateway(QObject *parent)
+:   QObject(parent)
+{
+    mServer = new QTcpServer(this);
+    connect(mServer,SIGNAL(newConnection()),this,SLOT(handleNewConnection()));
+
+    QFile page(KControlPage);
+    if(page.open(QIODevice::ReadOnly))
+    {
+        mPage = page.readAll();
+    }
+}
+
+WebGateway::~WebGateway()
+{
+}
+
+bool WebGateway::listen(quint16 aPort)
+{
+    return mServer->listen(QHostAddress::Any,aPort);
+}
+
+QString WebGateway::errorString() const
+{
+    return mServer->errorString();
+}
+
+quint16 WebGateway::serverPort() const
+{
+    return mServer->serverPort();
+}
+
+void WebGateway::handleNewConnection()
+{
+    while(mServer->hasPendingConnections())
+    {
+        QTcpSocket* socket = mServer->nextPendingConnection();
+        mHeads.insert(socket,QByteArray());
+        connect(socket,SIGNAL(readyRead()),this,SLOT(readRequestHead()));
+        connect(socket,SIGNAL(disconnected()),this,SLOT(discardSocket()));
+    }
+}
+
+void WebGateway::discardSocket()
+{
+    QTcpSocket* socket = qobject_cast<QTcpSocket*>(sender());
+    mHeads.remove(socket);
+    socket->deleteLater();
+}
+
+void WebGateway::readRequestHead()
+{
+    QTcpSocket* socket = qobject_cast<QTcpSocket*>(sender());
+    if(!socket || !mHeads.contains(socket))
+    {
+        return;
+    }
+    QByteArray& head = mHeads[socket];
+    head.append(socket->readAll());
+    int end = head.indexOf(KHeadEnd);
+    if(-1 == end)
+    {
+        if(KMaxHeadInBytes < head.size())
+        {
+            writeHttpResponse(socket,"431 Request Header Fields Too Large","text/plain","");
+        }
+        return;
+    }
+    QByteArray request = head.left(end);
+    mHeads.remove(socket);
+    handleRequestHead(socket,request);
+}
+
+void WebGateway::handleRequestHead(QTcpSocket* aSocket, const QByteArray& aHead)
+{
+    QList<QByteArray> lines = aHead.split('\n');
+    QList<QByteArray> requestLine = lines.takeFirst().trimmed().split(' ');
+    QHash<QByteArray,QByteArray> headers;
+    foreach(const QByteArray& line, lines)
+    {
+        int colon = line.indexOf(':');
+        if(0 < colon)
+        {
+            headers.insert(line.left(colon).trimmed().toLower(),line.mid(colon+1).trimmed());
+        }
+    }
+    if(3 > requestLine.count() || "GET" != requestLine.at(0))
+    {
+        writeHttpResponse(aSocket,"405 Method Not Allowed","text/plain","");
+        return;
+    }
+
+    QByteArray path = requestLine.at(1);
+    if(KPagePath == path || KIndexPath == path)
+    {
+        writeHttpResponse(aSocket,"200 OK","text/html; charset=utf-8",mPage);
+        return;
+    }
+    QByteArray key = headers.value("sec-websocket-key");
+    if(KWebSocketPath != path || key.isEmpty() ||
+       !headers.value("upgrade").toLower().contains("websocket"))
+    {
+        writeHttpResponse(aSocket,"404 Not Found","text/plain","");
+        return;
+    }
+
+    QByteArray accept = QCryptographicHash::hash(key+KWebSocketGuid,QCryptographicHash::Sha1).toBase64();
+    bool deflate = KDeflateSupported && headers.value("sec-websocket-extensions").contains(KPermessageDeflate);
+    QByteArray response = "HTTP/1.1 101 Switching Protocols\r\n"
+                          "Upgrade: websocket\r\n"
+                          "Connection: Upgrade\r\n"
+                          "Sec-WebSocket-Accept: "+accept+"\r\n";
+    if(deflate)
+    {
+        response += "Sec-WebSocket-Extensions: "+KPermessageDeflate+
+                    "; server_no_context_takeover; client_no_context_takeover\r\n";
+    }
+    response += "\r\n";
+    aSocket->write(response);
+
+    // From here on the socket belongs to the session
+    disconnect(aSocket,0,this,0);
+    WebSocketSession* session = new WebSocketSession(aSocket,deflate);
+    qDebug()<<"websocket session"<<session->peerName()<<"deflate:"<<deflate;
+    emit sessionOpened(session);
+}
+
+void WebGateway::writeHttpResponse(QTcpSocket* aSocket, QByteArray aStatus, QByteArray aContentType, QByteArray aBody)
+{
+    mHeads.remove(aSocket);
+    QByteArray response = "HTTP/1.1 "+aStatus+"\r\n"
+                          "Content-Type: "+aContentType+"\r\n"
+                          "Content-Length: "+QByteArray::number(aBody.size())+"\r\n"
+                          "Connection: close\r\n\r\n"+aBody;
+    aSocket->write(response);
+    aSocket->disconnectFromHost();
+}
+
+//eof
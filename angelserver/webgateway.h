@@ -0,0 +1,79 @@
+#ifndef WEBGATEWAY_H
+#define WEBGATEWAY_H
+
+#include <QObject>
+#include <QHash>
+#include <QByteArray>
+#include "clientsession.h"
+
+class QTcpServer;
+class QTcpSocket;
+struct z_stream_s;
+
+// Browser controller. Requests and responses are the same strings the native
+// client uses, carried in websocket text frames (RFC 6455), deflated per message
+// when the browser negotiated permessage-deflate (RFC 7692) and the server was
+// built with zlib.
+class WebSocketSession : public ClientSession
+{
+    Q_OBJECT
+
+public:
+    WebSocketSession(QTcpSocket* aSocket, bool aDeflate, QObject *parent = 0);
+    ~WebSocketSession();
+
+    void send(const QString& aFrame);
+    QString peerName() const;
+
+private slots:
+    void readFrames();
+    void handleDisconnected();
+
+private:
+    void writeFrame(int aOpcode, const QByteArray& aPayload, bool aCompressed = false);
+    bool deflateMessage(const QByteArray& aMessage, QByteArray& aCompressed);
+    bool inflateMessage(const QByteArray& aCompressed, QByteArray& aMessage);
+    void handleMessage(const QByteArray& aMessage);
+
+private:
+    QTcpSocket* mSocket;
+    QByteArray mBuffer;
+    QByteArray mMessage;        // fragments of the message being received
+    bool mMessageCompressed;
+    bool mDeflate;
+    z_stream_s* mDeflater;      // zlib streams, only with WEBSOCKET_DEFLATE
+    z_stream_s* mInflater;
+};
+
+// Embedded http endpoint: serves the control page and upgrades /ws to a websocket
+class WebGateway : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit WebGateway(QObject *parent = 0);
+    ~WebGateway();
+
+    bool listen(quint16 aPort);
+    QString errorString() const;
+    quint16 serverPort() const;
+
+signals:
+    void sessionOpened(ClientSession* aSession);
+
+private slots:
+    void handleNewConnection();
+    void readRequestHead();
+    void discardSocket();
+
+private:
+    void handleRequestHead(QTcpSocket* aSocket, const QByteArray& aHead);
+    void writeHttpResponse(QTcpSocket* aSocket, QByteArray aStatus, QByteArray aContentType, QByteArray aBody);
+
+private:
+    QTcpServer* mServer;
+    QHash<QTcpSocket*,QByteArray> mHeads;   // connections still sending their http request
+    QByteArray mPage;
+};
+
+#endif // WEBGATEWAY_H
@@ -0,0 +1,57 @@
+#include <cstdlib>
+#include <new>
+#include "allocationcounter.h"
+
+static int gAllocations = 0;
+
+int allocationCount()
+{
+    return gAllocations;
+}
+
+#ifdef __GLIBC__
+// The executable's definitions take precedence over libc for every library
+// loaded, the real allocator stays reachable through its __libc_ names
+extern "C" {
+void* __libc_malloc(std::size_t aSize);
+void* __libc_calloc(std::size_t aCount, std::size_t aSize);
+void* __libc_realloc(void* aMemory, std::size_t aSize);
+
+void* malloc(std::size_t aSize)
+{
+    __sync_fetch_and_add(&gAllocations,1);
+    return __libc_malloc(aSize);
+}
+
+void* calloc(std::size_t aCount, std::size_t aSize)
+{
+    __sync_fetch_and_add(&gAllocations,1);
+    return __libc_calloc(aCount,aSize);
+}
+
+void* realloc(void* aMemory, std::size_t aSize)
+{
+    __sync_fetch_and_add(&gAllocations,1);
+    return __libc_realloc(aMemory,aSize);
+}
+}
+#else
+// operator new[] forwards to operator new, so arrays are counted as well
+void* operator new(std::size_t aSize) throw(std::bad_alloc)
+{
+    ++gAllocations;
+    void* memory = std::malloc(aSize ? aSize : 1);
+    if(!memory)
+    {
+        throw std::bad_alloc();
+    }
+    return memory;
+}
+
+void operator delete(void* aMemory) throw()
+{
+    std::free(aMemory);
+}
+#endif
+
+//eof
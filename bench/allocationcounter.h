@@ -0,0 +1,9 @@
+#ifndef ALLOCATIONCOUNTER_H
+#define ALLOCATIONCOUNTER_H
+
+// Number of heap allocations since start up. With glibc every malloc, calloc
+// and realloc is counted, which covers QString/QByteArray growth done by Qt
+// itself. Elsewhere only operator new is seen.
+int allocationCount();
+
+#endif // ALLOCATIONCOUNTER_H
@@ -0,0 +1,55 @@
+#-------------------------------------------------
+#
+# Micro benchmarks for the protocol and parsing hot paths.
+# Builds the client and server sources under test, without their main().
+#
+#   ./protocolbench                 walltime, ns/op and allocations/op
+#   ./protocolbench -callgrind      instruction counts, needs valgrind
+#   ./protocolbench readResponse    a single benchmark
+#
+#-------------------------------------------------
+
+QT       += core gui network xmlpatterns testlib
+
+TARGET = protocolbench
+TEMPLATE = app
+CONFIG += console
+CONFIG -= app_bundle
+
+INCLUDEPATH += ../angelclient ../angelserver
+
+SOURCES += protocolbench.cpp \
+        allocationcounter.cpp \
+        ../angelclient/angelclient.cpp \
+        ../angelserver/server.cpp \
+        ../angelserver/playerdetector.cpp \
+        ../angelserver/libraryindex.cpp \
+        ../angelserver/artworkcache.cpp \
+        ../angelserver/clientsession.cpp \
+        ../angelserver/webgateway.cpp \
+        ../angelserver/admissioncontrol.cpp
+
+HEADERS  += allocationcounter.h \
+        ../angelclient/angelclient.h \
+        ../angelserver/server.h \
+        ../angelserver/playerdetector.h \
+        ../angelserver/libraryindex.h \
+        ../angelserver/artworkcache.h \
+        ../angelserver/clientsession.h \
+        ../angelserver/webgateway.h \
+        ../angelserver/admissioncontrol.h
+
+FORMS    += ../angelclient/angelclient.ui
+
+#embedd widgets dependency, as in angelclient.pro
+include(../../../embedded-widgets-1.1.0/src/svgbutton/svgbutton.pri)
+include(../../../embedded-widgets-1.1.0/src/common/common.pri)
+RESOURCES += ../../../embedded-widgets-1.1.0/skins/beryl_svgbutton.qrc \
+    ../angelserver/resources.qrc
+# embed widgets dependency
+
+# permessage-deflate in the web gateway, as in angelserver.pro
+unix {
+    DEFINES  += WEBSOCKET_DEFLATE
+    LIBS     += -lz
+}
@@ -0,0 +1,287 @@
+#include <QtTest/QtTest>
+#include <QApplication>
+#include <QFile>
+#include <cstdio>
+#include "allocationcounter.h"
+#include "angelclient.h"
+#include "server.h"
+#include "playerdetector.h"
+
+// Every row first checks the result against its expected column, a faster but
+// wrong implementation fails here. Besides the QTestLib result every row is
+// then timed in batches for at least KMeasureTimeInMs and reported as ns/op
+// and allocations/op.
+const int KMeasureTimeInMs = 200;
+const int KBatch = 64;
+const int KExtraPlayers = 15;   // a commands file with a few more players than we ship
+
+// what the shipped commands xml says, results are checked against it before timing
+#ifdef Q_OS_LINUX
+const QString KPlayerCommand    = "rhythmbox-client ";
+const QString KNowPlayingOption = "--print-playing";
+const QString KPlayOption       = "--play";
+const QString KQuitOption       = "--quit";
+#else
+const QString KPlayerCommand    = "clamp ";
+const QString KNowPlayingOption = "/title";
+const QString KPlayOption       = "/play";
+const QString KQuitOption       = "/quit";
+#endif
+
+#define MEASURE(aBody) \
+    QBENCHMARK { aBody; } \
+    { \
+        int iterations = 0; \
+        int allocations = allocationCount(); \
+        QTime time; \
+        time.start(); \
+        do \
+        { \
+            for(int batch = 0; batch < KBatch; ++batch) \
+            { \
+                aBody; \
+            } \
+            iterations += KBatch; \
+        } while(time.elapsed() < KMeasureTimeInMs); \
+        report(iterations,time.elapsed(),allocationCount()-allocations); \
+    }
+
+class ProtocolBench : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+    void cleanupTestCase();
+
+    void option_data();
+    void option();
+    void commandForPlayer_data();
+    void commandForPlayer();
+    void responseFrame_data();
+    void responseFrame();
+    void readResponse_data();
+    void readResponse();
+    void timeInSecs_data();
+    void timeInSecs();
+
+private:
+    void report(int aIterations, int aElapsedInMs, int aAllocations);
+
+private:
+    PlayerDetector* mDetector;
+    PlayerInfo mPlayer;
+    AngelClient* mClient;
+    int mSink;      // results are summed here so the calls are not optimized away
+};
+
+static QString longTitle(int aLength)
+{
+    QString title;
+    while(title.length() < aLength)
+    {
+        title += "Symphony No. 9 in D minor, Op. 125 \"Choral\" - IV. Presto - Allegro assai - ";
+    }
+    return title.left(aLength);
+}
+
+static QString nonAsciiTitle()
+{
+    return QString::fromUtf8("Sigur R\xc3\xb3s - Hopp\xc3\xadpolla / \xe5\x9d\x82\xe6\x9c\xac\xe9\xbe\x8d\xe4\xb8\x80 - \xd0\x95\xd1\x89\xd1\x91 \xd1\x80\xd0\xb0\xd0\xb7");
+}
+
+// reply to "artchunk hash offset", a full chunk of base64 cover data
+static QString artworkChunk()
+{
+    QByteArray chunk(24*1024,'\xa5');
+    return "0 "+QString::fromLatin1(chunk.toBase64());
+}
+
+static void dropDebugOutput(QtMsgType aType, const char* aMessage)
+{
+    // the code under test logs every call, keep the formatting cost but not the terminal
+    if(QtDebugMsg != aType)
+    {
+        fprintf(stderr,"%s\n",aMessage);
+    }
+}
+
+void ProtocolBench::initTestCase()
+{
+    mSink = 0;
+#ifdef Q_OS_LINUX
+    QFile commands(":/xml/linux_commands.xml");
+#else
+    QFile commands(":/xml/win_commands.xml");
+#endif
+    QVERIFY(commands.open(QIODevice::ReadOnly));
+    mDetector = new PlayerDetector(this);
+    QVERIFY(mDetector->readCommands(&commands));
+    mPlayer = mDetector->mPlayers.first();
+    for(int i = 1; i <= KExtraPlayers; ++i)
+    {
+        PlayerInfo extra = mPlayer;
+        extra.name = QString("player%1").arg(i,2,10,QChar('0'));
+        mDetector->mPlayers.append(extra);
+    }
+
+    mClient = new AngelClient;
+}
+
+void ProtocolBench::cleanupTestCase()
+{
+    delete mClient;
+    mClient = 0;
+    qDebug()<<mSink;
+}
+
+void ProtocolBench::report(int aIterations, int aElapsedInMs, int aAllocations)
+{
+    printf("%s(%s): %.1f ns/op, %.2f allocations/op\n",
+           QTest::currentTestFunction(),QTest::currentDataTag(),
+           aElapsedInMs*1000000.0/aIterations,double(aAllocations)/aIterations);
+    fflush(stdout);
+}
+
+// Server::option() is this lookup on the active player
+void ProtocolBench::option_data()
+{
+    QTest::addColumn<QString>("id");
+    QTest::addColumn<QString>("expected");
+    QTest::newRow("first") << "nowplaying" << KNowPlayingOption;
+    QTest::newRow("play") << "play" << KPlayOption;
+    QTest::newRow("last") << "quit" << KQuitOption;
+    QTest::newRow("missing") << "shuffle" << QString();
+    QTest::newRow("long") << longTitle(1024) << QString();
+    QTest::newRow("nonascii") << QString::fromUtf8("wiedergabe-fortsetzen-\xe5\x86\x8d\xe7\x94\x9f") << QString();
+}
+
+void ProtocolBench::option()
+{
+    QFETCH(QString,id);
+    QFETCH(QString,expected);
+    QCOMPARE(mPlayer.options.value(id),expected);
+    MEASURE(mSink += mPlayer.options.value(id).length())
+}
+
+// Server::commandForPlayer() is a lookup by name in the detector
+void ProtocolBench::commandForPlayer_data()
+{
+    QTest::addColumn<QString>("name");
+    QTest::addColumn<QString>("expected");
+    QTest::newRow("first") << mPlayer.name << KPlayerCommand;
+    QTest::newRow("last") << QString("player%1").arg(KExtraPlayers,2,10,QChar('0')) << KPlayerCommand;
+    QTest::newRow("unknown") << "audacious" << QString();
+    QTest::newRow("nonascii") << QString::fromUtf8("r\xc3\xa9thmbox") << QString();
+}
+
+void ProtocolBench::commandForPlayer()
+{
+    QFETCH(QString,name);
+    QFETCH(QString,expected);
+    const PlayerInfo* found = mDetector->player(name);
+    QCOMPARE((found)?(found->command):(QString()),expected);
+    MEASURE(const PlayerInfo* player = mDetector->player(name); mSink += (player)?(player->command.length()):(0))
+}
+
+void ProtocolBench::responseFrame_data()
+{
+    QTest::addColumn<QString>("request");
+    QTest::addColumn<QString>("text");
+    QTest::newRow("short") << "nowplaying" << "Radiohead - Airbag";
+    QTest::newRow("long title") << "nowplaying" << longTitle(1024);
+    QTest::newRow("huge title") << "nowplaying" << longTitle(16*1024);
+    QTest::newRow("nonascii") << "nowplaying" << nonAsciiTitle();
+    QTest::newRow("percent encoded") << "enqueue file:///home/user/Music/AC%2FDC/Back%20in%20Black/01%20Hells%20Bells.mp3"
+        << "queued %1 %2 %3";
+    QTest::newRow("artwork chunk") << "artchunk 0123456789abcdef0123456789abcdef 0" << artworkChunk();
+}
+
+void ProtocolBench::responseFrame()
+{
+    QFETCH(QString,request);
+    QFETCH(QString,text);
+    // spelled out here rather than taken from the server's template
+    QString expected = "<response><status>200</status><request>"+request+
+                       "</request><text>"+text+"</text></response>";
+    QCOMPARE(Server::responseFrame(200,request,text),expected);
+    MEASURE(mSink += Server::responseFrame(200,request,text).length())
+}
+
+// "concatenated" and "truncated" are what a single socket read can hold when
+// the framing in readServerResponse() is bypassed. Neither is one xml
+// document, so nothing can be read from them.
+void ProtocolBench::readResponse_data()
+{
+    QTest::addColumn<QString>("frame");
+    QTest::addColumn<int>("status");
+    QTest::addColumn<QString>("request");
+    QTest::addColumn<QString>("text");
+    QString nowPlaying = Server::responseFrame(200,"nowplaying","Radiohead - Airbag");
+    QString artchunk = "artchunk 0123456789abcdef0123456789abcdef 0";
+    QTest::newRow("short") << nowPlaying << 200 << "nowplaying" << "Radiohead - Airbag";
+    QTest::newRow("long title") << Server::responseFrame(200,"nowplaying",longTitle(1024))
+        << 200 << "nowplaying" << longTitle(1024).simplified();
+    QTest::newRow("huge title") << Server::responseFrame(200,"nowplaying",longTitle(16*1024))
+        << 200 << "nowplaying" << longTitle(16*1024).simplified();
+    QTest::newRow("nonascii") << Server::responseFrame(200,"nowplaying",nonAsciiTitle())
+        << 200 << "nowplaying" << nonAsciiTitle();
+    QTest::newRow("artwork chunk") << Server::responseFrame(200,artchunk,artworkChunk())
+        << 200 << artchunk << artworkChunk();
+    QTest::newRow("concatenated") << nowPlaying+Server::responseFrame(200,"syncnow","syncnow")+nowPlaying
+        << 0 << QString() << QString();
+    QTest::newRow("truncated") << nowPlaying.left(nowPlaying.length()/2) << 0 << QString() << QString();
+}
+
+// The three reads AngelClient::handleResponse() makes for every frame,
+// compared the way it uses them
+void ProtocolBench::readResponse()
+{
+    QFETCH(QString,frame);
+    QFETCH(int,status);
+    QFETCH(QString,request);
+    QFETCH(QString,text);
+    QCOMPARE(mClient->readResponse(frame,"status").toInt(),status);
+    QCOMPARE(mClient->readResponse(frame,"request").simplified(),request);
+    QCOMPARE(mClient->readResponse(frame,"text").simplified(),text);
+    MEASURE(mSink += mClient->readResponse(frame,"status").toInt()
+                + mClient->readResponse(frame,"request").length()
+                + mClient->readResponse(frame,"text").length())
+}
+
+void ProtocolBench::timeInSecs_data()
+{
+    QTest::addColumn<QString>("duration");
+    QTest::addColumn<int>("expected");
+    QTest::newRow("mm:ss") << "3:25" << 205;
+    QTest::newRow("hh:mm:ss") << "1:02:03" << 3723;
+    QTest::newRow("padded") << "  12:34 \n" << 754;
+    QTest::newRow("seconds only") << "225" << -1;
+    QTest::newRow("unknown") << "Unknown" << -1;
+    // full width digits are not digits to QString::toInt()
+    QTest::newRow("nonascii digits") << QString::fromUtf8("\xef\xbc\x93:\xef\xbc\x92\xef\xbc\x95") << 0;
+    QTest::newRow("long garbage") << QString(4096,':') << -1;
+}
+
+void ProtocolBench::timeInSecs()
+{
+    QFETCH(QString,duration);
+    QFETCH(int,expected);
+    QCOMPARE(mClient->timeInSecs(duration),expected);
+    MEASURE(mSink += mClient->timeInSecs(duration))
+}
+
+int main(int argc, char *argv[])
+{
+    QApplication app(argc, argv);
+    // the client keeps its session snapshot per application
+    app.setOrganizationName("angel");
+    app.setApplicationName("protocolbench");
+    qInstallMsgHandler(dropDebugOutput);
+    ProtocolBench bench;
+    return QTest::qExec(&bench, argc, argv);
+}
+
+#include "protocolbench.moc"
+
+//eof